@@ -60,6 +60,10 @@
 //           R<Z retract>
 //           [L<repetitions per depth level>]   (optional)
 //           [H<final return>]                  (optional)
+//           [J<radial retract clearance>]      (optional)
+//           [I<plunge feed>]                   (optional)
+//           [K<resume pass>]                   (optional)
+//           [E<evaluate>]                      (optional)
 //
 //  Parameters:
 //
@@ -77,14 +81,284 @@
 //
 //      R   Z retract distance before each plunge (POSITIVE value).
 //
-//      L   Number of repetitions at each depth level (integer ≥ 1).
+//          With M800_ADAPTIVE_DEPTH = 1 the passes inside the sag zone are
+//          deeper than P (see DEPTH SCHEDULE), and M800_FINISH_STEP sets an
+//          optional smaller step for the last pass to the final depth.
+//
+//      L   Number of repetitions at each roughing depth level (integer ≥ 1).
 //          Used when multiple cutting strokes are required at the same depth.
+//          The zero-penetration safety pass always runs once.
 //          Default = L1.
 //
+//          Extra passes at the finished size (to take out tool deflection)
+//          are set separately with M807 P (default M800_SPRING_PASSES): they
+//          run only at X_final, after the L repetitions of the last level.
+//
 //      H   Return to the initial position at the end of the cycle.
 //          H1 = return (default)
 //          H0 = do not return
 //
+//      J   Radial retract clearance (POSITIVE value, optional).
+//          When given, BACKX only backs the tool off to (current depth - J)
+//          instead of going all the way back to the sag-compensated start X.
+//          The return stroke runs inside the slot already cut, and the next
+//          plunge only feeds J + P instead of the whole depth.
+//          The retract is never shallower than the sag-compensated start X.
+//          Default = full retract.
+//
+//      I   Plunge (in-feed) rate for the X moves, in mm/min (POSITIVE value,
+//          optional). The Z cutting strokes run at the modal F, so F can be
+//          set for the stroke and I kept gentle for the plunge.
+//          Default = F.
+//
+//      K   Resume (optional).
+//          K<n> = start at radial pass n (1..passes), skipping the safety
+//                 pass and every shallower level.
+//          K-1  = resume after the last stroke physically cut by the previous
+//                 M800 with the same D Q S P R L J words and start position,
+//                 eg. after a reset or alarm. Runs the full cycle (with a
+//                 message) when there is nothing to resume.
+//          Progress is recorded when a stroke has been executed, not when it
+//          was queued, so a resume never skips uncut depth.
+//          With M800_CHECKPOINT = n the progress is also saved to NVS at the
+//          first stroke of a cycle and then every n depth levels, and K-1
+//          uses it when nothing was recorded since power-up: after a power
+//          loss, home and rerun the block with K-1 to resume at the last
+//          checkpoint. The write is deferred to the realtime loop right after
+//          the planner has been filled, never from the move generator.
+//          EEPROM or FRAM store every checkpoint. NVS emulated in flash (or
+//          RAM) only buffers it until grblHAL writes the buffer out, which it
+//          does not do while a cycle runs: such builds report a warning in $I
+//          and at the first cycle after power-up, checkpoints there only help
+//          against a reset.
+//
+//      E   Evaluate (optional).
+//          E1 = do not move: run the same pass schedule (including K) through
+//               the cycle generator and report
+//
+//               M800 ESTIMATE: time=<s>s strokes=<n> blocks=<n> air=<s>s rapid=<s>s length=<mm>mm ramp=<s>s
+//
+//               from settings.axis[] max rate and acceleration (Z: M803 when
+//               set). air is the time spent on air-cut strokes, rapid on G0
+//               moves, length the total tool path, ramp the time lost to
+//               acceleration compared to moving at full rate throughout.
+//               No CYCLE START/END is sent and the parser position is not
+//               changed. With M800_INSTRUMENT the time taken
+//               to generate the moves is reported as well
+//               (M800 STATS: estimate moves=<n> gen=<ms>), a benchmark of the
+//               generator on the target itself.
+//          E2 = M800_INSTRUMENT builds only: report the statistics of the
+//               last cycle (M800 E2, no other words).
+//          E3 = M800_STATS builds only: report the production totals
+//               (M800 E3, no other words), E4 clears them.
+//
+// ----------------------------------------------------------------------------
+//  PRODUCTION STATISTICS (M800_STATS)
+// ----------------------------------------------------------------------------
+//
+//      With M800_STATS = 1 the plugin keeps running totals over every cycle
+//      in RAM and saves them to NVS every M800_STATS_FLUSH completed cycles
+//      and at the first one after M800_STATS_MINUTES (deferred to the
+//      realtime loop like the checkpoint), and on M800 E3. NVS is often
+//      flash, so it is not written per cycle: a power loss loses at most
+//      the cycles since the last save. Counting is a few adds per move,
+//      there is no output until M800 E3:
+//
+//          M800 TOTAL: cycles=<n> strokes=<n> cut=<s>s air=<s>s rapid=<s>s blocks avg=<n>
+//          M800 TOTAL M800: cycles=<n>         ; M800 and M806 cycles
+//          M800 TOTAL M81<n>: cycles=<n>       ; per preset
+//          M800 TOTAL T<tool>: cycles=<n> strokes=<n>
+//
+//      Strokes and times count the moves executed (estimated move times,
+//      including cycles aborted part way), cycles only the completed ones.
+//      blocks avg is the planner occupancy when a cycle move was queued.
+//      The first 4 tools used get their own counters (tool wear), M800 E4
+//      clears everything.
+//
+// ----------------------------------------------------------------------------
+//  BIDIRECTIONAL STROKES (M807 Q1, M800_BIDIRECTIONAL)
+// ----------------------------------------------------------------------------
+//
+//      For double-edged shaper tools both Z strokes can cut. With M807 Q1
+//      (default M800_BIDIRECTIONAL) the cycle cuts depth N going -Z, steps
+//      in by P at the far end and cuts depth N+1 coming back +Z, so there is
+//      no air return stroke. L repetitions also alternate direction at the
+//      same depth.
+//
+//      X backs off (BACKX + BACKZ, honouring J) only when the cycle ends at
+//      the far end, or every M800_EVACUATE_STROKES strokes for chip
+//      evacuation. The next stroke then starts again from Z_start + R.
+//
+// ----------------------------------------------------------------------------
+//  BLENDED CORNERS (M800_BLEND)
+// ----------------------------------------------------------------------------
+//
+//      By default every stroke is a rectangle of orthogonal moves (SAFE,
+//      DEPTH, LENGTH, BACKX, BACKZ) and the planner slows down at each 90°
+//      junction, which dominates short keyways. With M800_BLEND > 0 (mm):
+//
+//      • BACKX lifts off at an angle, moving back +Z along the cut slot by
+//        up to M800_BLEND but no more than the radial retract
+//      • BACKZ stops M800_BLEND short of Z_start + R, SAFE and DEPTH become
+//        two corner moves into the next stroke that end at X_target at
+//        Z_start + R − M800_BLEND
+//
+//      The entry corner is limited to R and to half the radial distance to
+//      the new depth, so X only ever moves toward the wall at Z ≥ Z_start,
+//      as with square corners. Strokes after a rotary index, band plunges
+//      (M802) and bidirectional steps keep square corners.
+//
+// ----------------------------------------------------------------------------
+//  Z ACCELERATION OVERRIDE (M803)
+// ----------------------------------------------------------------------------
+//
+//          M803 P<Z acceleration>          ; mm/s², as $122
+//          M803                            ; back to $122
+//
+//      Keyway strokes are short, so their time depends on the Z acceleration
+//      more than on F. M803 sets a Z acceleration for the moves of the
+//      following M800 cycles only: it is applied while each cycle block is
+//      queued and the machine setting is restored right after, so other
+//      G-code and jogging keep $122. A block is only queued with the
+//      override once the planner has room for it, so mc_line() never waits
+//      in the realtime loop while $122 is replaced. E1 uses the same value
+//      and reports ramp=, the time lost to acceleration, to compare settings
+//      per tool. The value is not checked against the drive, a too high one
+//      loses steps like a too high $122.
+//
+// ----------------------------------------------------------------------------
+//  TOOL SETUP (M807)
+// ----------------------------------------------------------------------------
+//
+//          M807 P<spring passes>           ; extra strokes at X_final
+//          M807 Q1                         ; double-edged tool, Q0 = single
+//          M807                            ; back to the build defaults
+//
+//      Spring passes and the cutting edges depend on the tool, so M807 sets
+//      them for the following M800 cycles; M800_SPRING_PASSES and
+//      M800_BIDIRECTIONAL are only the values after reset and after a bare
+//      M807, a word not given keeps its build default. Z bands (M802) and the
+//      probe trim (M804) need the tool out of the bore after every stroke: a
+//      cycle with a double-edged tool and either of them set is cancelled.
+//
+// ----------------------------------------------------------------------------
+//  ADAPTIVE STROKE FEED (M800_ADAPTIVE_FEED)
+// ----------------------------------------------------------------------------
+//
+//      With M800_ADAPTIVE_FEED = n (% of F) and a load source registered by
+//      the driver code with keyway_set_load_source() (see keyway.h), the Z
+//      load is sampled from the realtime loop while cutting LENGTH strokes
+//      execute. After each stroke the peak load sets the feed of the strokes
+//      queued from then on: below M800_LOAD_LOW +10% up to n% of F (and the
+//      Z max rate), above M800_LOAD_HIGH −25% down to 50% of F. Air-cut
+//      strokes, plunges and rapids are not affected. Strokes already in the
+//      planner keep their feed, so a change takes effect a few strokes later.
+//      Without a load source the cycle runs at F.
+//
+// ----------------------------------------------------------------------------
+//  PROBE TRIM (M804, M800_PROBE, single-edged tools)
+// ----------------------------------------------------------------------------
+//
+//          M804 P<max trim>                ; probe in the following M800 cycles
+//          M804                            ; off
+//
+//      Before the last level (the finishing pass and the spring strokes)
+//      the cycle waits for the planner, enters the bore at the retract X to
+//      the middle of the M800 Q band and probes +X at the plunge feed with
+//      the grblHAL probe input (tool touch or stylus), at most P past the
+//      floor of the previous level and never past the finished depth: a
+//      trim can be at most the last step. The difference between that floor and
+//      the contact is the depth the tool left by deflection; it is added to
+//      the last level so the finished keyway ends at D:
+//
+//               M800 PROBE: X=<contact> floor=<commanded> trim=<mm>
+//
+//      A trim above P is reported and not applied, no contact ends the
+//      cycle with a warning. E1 and the status estimate do not probe, a K
+//      resume into the last level skips the probe.
+//
+// ----------------------------------------------------------------------------
+//  CYCLE PRESETS (M810..M817, M800_PRESETS)
+// ----------------------------------------------------------------------------
+//
+//          $450=D2 Q10 S8 P0.5 R2 L1 H1 J0.2   ; store preset 0
+//          M810                                ; M800 with preset 0
+//          M810 D2.2 K-1                       ; preset 0 with words replaced
+//
+//      With M800_PRESETS = n the plugin registers n settings ($450 up) in
+//      NVS, each holding the words D Q S P R and optionally L H J I. The
+//      text is checked with the M800 rules when it is written, an empty
+//      value clears the preset. M81n takes every word it does not set from
+//      preset n; K and E are per call only. An empty preset is an error.
+//
+// ----------------------------------------------------------------------------
+//  BATCH QUEUE (M805, M806, M800_QUEUE)
+// ----------------------------------------------------------------------------
+//
+//          M805 X10 Z10 D2 Q10 S8 P0.5 R2      ; queue a cycle at X10 Z10
+//          G55
+//          M805 X10 Z10 D2 Q10 S8 P0.5 R2 L2   ; same cycle, other offset
+//          M806                                ; run the queue
+//          M805                                ; empty the queue
+//
+//      With M800_QUEUE = n, M805 stores up to n cycles: the M800 words (no
+//      K or E), the F in effect and the start given by the axis words, in
+//      machine coordinates. M805 claims the axis words, so queueing moves
+//      nothing: they are converted as a G0 target would be (G20, G90/G91,
+//      work, G92 and tool offsets), axes not given keep the previous
+//      entry's start (the parser position for the first). M806 runs them in
+//      order as a single block. Each cycle is preceded by one G0 to its
+//      start, the only travel of the batch, planned behind the last move of
+//      the previous cycle: separate M800 blocks wait for the planner to
+//      empty after every cycle, the batch only after its last one. Without
+//      M800_ASYNC_END one CYCLE START / CYCLE END pair covers the batch,
+//      with it every cycle reports its own ID. M806 empties the queue,
+//      index, bands, Z acceleration, tool and probe setups in effect at M806
+//      apply to every cycle. A cancelled or aborted cycle ends the batch.
+//
+// ----------------------------------------------------------------------------
+//  MULTI-KEYWAY INDEXING (M801, M800_INDEX_AXIS)
+// ----------------------------------------------------------------------------
+//
+//      With M800_INDEX_AXIS set to a rotary axis (eg. A_AXIS) one M800 cuts
+//      several keyways around the bore:
+//
+//          M801 P<count> [Q<angle step>] [L<order>]
+//
+//      P   Number of keyways (1..255), P1 = indexing off.
+//      Q   Rotary step between keyways, default 360 / P.
+//      L   L0 = every keyway at a depth level before stepping in (default),
+//          L1 = each keyway to full depth in turn.
+//
+//      The setting applies to the following M800 blocks. Keyway 0 is at the
+//      rotary position where M800 starts. The safety pass runs once for all
+//      keyways. Index moves are G0 on the rotary axis only, always with the
+//      tool out at Z_start + R (bidirectional strokes leave the bore first).
+//      With H1 the axis is indexed back to the start before the return.
+//
+// ----------------------------------------------------------------------------
+//  Z BANDS (M802, single-edged tools, M800_MAX_BANDS > 1)
+// ----------------------------------------------------------------------------
+//
+//          M802 P<Z offset> Q<length>      ; append a band
+//          M802                            ; clear the bands
+//
+//      Cuts several keyway segments along Z in one M800. The M800 Q band
+//      (Z_start → Z_start − Q) is band 0, each M802 adds a band starting P
+//      below Z_start and Q long. Bands must lie one after the other in −Z
+//      without overlapping, otherwise M800 cancels with a warning.
+//
+//      Every band is cut at a depth level before stepping in: after the
+//      LENGTH stroke of a band the tool retracts to the start X (X_new_start),
+//      rapids along Z to the next band and plunges there at the plunge feed.
+//      Only after the last band does it leave the bore to Z_start + R, also
+//      at the start X. The rapids cross uncut wall between the bands, so J
+//      does not apply to them: with bands J only shortens the plunge from
+//      Z_start + R. Resume (K-1) and the status report
+//      count a stroke once all bands of it are cut. Up to
+//      M800_MAX_BANDS − 1 extra bands, the setting applies to the
+//      following M800 blocks.
+//
 // ----------------------------------------------------------------------------
 //  COMPLETE PROGRAM EXAMPLE
 // ----------------------------------------------------------------------------
@@ -110,13 +384,132 @@
 //      • mc_line() for both G0 and G1 moves
 //      • plan_line_data_t.condition.rapid_motion to select rapid/feed motion
 //      • gc_state.feed_rate for cutting feed (F-word not trapped locally)
+//      • an air-cut feed for strokes that cannot reach material
+//        (M800_AIR_FEED_PERCENT, % of the Z max rate): the safety pass and any
+//        pass whose depth removes no section from the bore wall
+//      • gc_state.position as the cycle start point (see M800_PARSER_START)
+//      • grbl.on_execute_realtime to feed the planner (see CYCLE GENERATOR)
 //      • protocol_buffer_synchronize() to ensure all moves are completed
 //
 //  No modifications to the GRBLHAL core are required.
 //
+//  With M800_VALIDATE_ONCE = 1 the soft limits are checked once per cycle
+//  for the extremes of the cycle envelope (X_new_start .. X_final, last Z
+//  .. Z_start + R) and the cycle moves are queued as validated, so mc_line()
+//  skips the per-move check. A violation raises the alarm before the first
+//  move instead of part way through the cycle.
+//
+//  The cycle is produced by a resumable move generator: moves are queued
+//  only while plan_check_full_buffer() reports room, from the realtime loop,
+//  so the foreground keeps servicing realtime commands and status reports
+//  instead of spinning inside mc_line(). A failing mc_line() (reset, alarm)
+//  stops generation immediately.
+//
+//  Moves whose target equals the last commanded position (eg. the SAFE move
+//  right after BACKZ, or the zero-penetration plunge of the safety pass) are
+//  not sent to the planner, so every planner block holds real motion and no
+//  zero-speed junction is forced. With M800_DEBUG the number of queued and
+//  skipped blocks is reported at the end of the cycle.
+//
+//  The depth schedule is evaluated once per cycle into a pass table (X,
+//  repetitions and feed class per level, M800_MAX_PASSES entries). Longer
+//  schedules compute the levels past the table when they are reached, so P
+//  and M800_MAX_PASSES only trade RAM for time per level. Moves only
+//  change X and Z of a single target buffer; the other axes are copied from
+//  the start position once.
+//
+//  With M800_PARSER_START = 1 (default) the start point is the position the
+//  parser has commanded so far (gc_state.position), so the cycle does not
+//  have to drain the planner first: the pre-positioning move is appended to
+//  the look-ahead queue right behind the preceding G0/G1 block.
+//  On exit the parser position is updated to the last cycle target, keeping
+//  the following blocks (and back-to-back M800 calls) coherent.
+//
+//  With M800_PARSER_START = 0 the planner is synchronized and the start
+//  point is read back from sys.position (behaviour of 1.0.x).
+//
 //  "M800 CYCLE END" is printed only after the planner buffer is fully empty,
 //  guaranteeing that the cycle has physically completed.
 //
+//  With M800_ASYNC_END = 1 the trailing synchronize is skipped: M800 returns
+//  as soon as the last move has been queued, so the sender can stream the
+//  next block while the cycle is still running. Start and end lines then
+//  carry a cycle id:
+//
+//      M800 CYCLE START ID=<n>
+//      M800 CYCLE END ID=<n>
+//
+//  The end line is sent from the realtime loop (grbl.on_execute_realtime)
+//  once the motion of cycle <n> has finished: M800_SEGMENT_BLOCKS planner
+//  blocks after its last one have been consumed, so its step segments have
+//  all been executed, or the planner is empty and the machine idle. A reset
+//  discards pending end reports.
+//
+//  Abort and resume: generation checks sys.abort before every move and stops
+//  at the first failing mc_line(), so a reset or alarm never has to wait for
+//  the rest of the cycle to be rejected move by move.
+//  Each cutting stroke is followed by a planner marker; the stroke counts as
+//  completed only once its motion has finished, as for the end line. This
+//  progress survives the reset (RAM only, not power cycles) and is what K-1
+//  resumes from. It is keyed to the words and start position of the cycle,
+//  so a different M800 never resumes from stale progress.
+//
+// ----------------------------------------------------------------------------
+//  STATUS REPORT (M800_STATUS_REPORT)
+// ----------------------------------------------------------------------------
+//
+//  While cycle moves are in the planner, the realtime status report (?)
+//  carries the progress of the move being executed, on release builds too:
+//
+//      <Run|MPos:...|M800:<pass>/<passes>,<rep>/<reps>,<phase>,<remaining>>
+//
+//      pass        0 = safety pass, 1..passes = radial passes
+//      rep         stroke at this level (1..reps)
+//      phase       POS SAFE DEPTH CUT BACKX BACKZ RET
+//      remaining   estimated seconds left (same model as E1)
+//
+//  Every queued cycle move carries a planner marker, so the field follows
+//  execution, not generation. The marker queue (M800_MARKER_QUEUE) also
+//  bounds how many cycle moves are queued ahead.
+//
+// ----------------------------------------------------------------------------
+//  INSTRUMENTATION (M800_INSTRUMENT)
+// ----------------------------------------------------------------------------
+//
+//  With M800_INSTRUMENT = 1 the cycle measures where the time goes and how
+//  deep the planner is when moves are added, and reports after CYCLE END
+//  (and on M800 E2):
+//
+//      M800 STATS: moves=<n> gen=<ms> line=<ms>
+//      M800 STATS <phase>: moves=<n> exec=<ms> blocks min=<n> avg=<n> dry=<n>
+//
+//  gen is the time spent generating moves, line the time spent in mc_line().
+//  exec is the executed time per phase, blocks the planner occupancy when a
+//  move of that phase was added, and dry the number of moves added to an
+//  empty planner (motion had stopped waiting for the generator).
+//
+//  The default time source is hal.get_elapsed_ticks() (1 ms). For finer
+//  resolution define M800_TICKS() and M800_TICKS_PER_MS, eg. for a Cortex-M
+//  cycle counter enabled by the driver:
+//
+//      -D "M800_TICKS()=DWT->CYCCNT" -D M800_TICKS_PER_MS=96000
+//
+// ----------------------------------------------------------------------------
+//  MOVE TRACE (M800_TRACE)
+// ----------------------------------------------------------------------------
+//
+//  With M800_TRACE = 1 every planner block of the cycle is written as it is
+//  queued, followed by a summary with the final geometry:
+//
+//      M800 TRACE G0 X<x> Z<z>
+//      M800 TRACE G1 X<x> Z<z> F<feed>
+//      M800 TRACE END blocks=<n> X_final=<x> Z_cut=<z> time=<s>s
+//
+//  E1 produces the same trace without motion, so traces of two builds can
+//  be captured from a sender log and diffed for block count, estimated time
+//  and final geometry. Trace lines are written synchronously (never
+//  dropped) and slow down generation on slow streams.
+//
 // ----------------------------------------------------------------------------
 //  DEBUG MODE (M800_DEBUG)
 // ----------------------------------------------------------------------------
@@ -129,6 +522,19 @@
 //      • Each depth pass with pass/rep counters
 //      • Final return coordinates
 //
+//  When M800_DEBUG = 2, the per-move lines are not written while the moves
+//  are generated: each move is stored as a small binary record (phase, pass,
+//  rep, X, Z) in a ring buffer of M800_LOG_RING entries, and the realtime
+//  loop formats and sends one record per call once the generator has filled
+//  the planner. Text output therefore never delays move generation, and
+//  debug builds cut the same way as release builds. When the buffer is full
+//  the record is dropped and counted, and
+//
+//      M800 LOG: <n> moves not logged
+//
+//  is sent when the backlog has been written. The other debug lines (geometry,
+//  feeds, blocks) are one per cycle and are still written directly.
+//
 //  When M800_DEBUG = 0, only:
 //
 //      • M800 CYCLE START
@@ -156,13 +562,151 @@
 #ifdef M800_ENABLE
 
 #ifndef M800_DEBUG
-#define M800_DEBUG 1   // 1 = debug ON, 0 = debug OFF
+#define M800_DEBUG 1   // 1 = debug ON, 0 = debug OFF, 2 = moves logged through a ring buffer
+#endif
+
+#ifndef M800_LOG_RING
+#define M800_LOG_RING 32      // M800_DEBUG = 2: buffered move records, power of 2
+#endif
+
+#ifndef M800_PARSER_START
+#define M800_PARSER_START 1   // 1 = start from gc_state.position, 0 = sync and read sys.position
+#endif
+
+#ifndef M800_BIDIRECTIONAL
+#define M800_BIDIRECTIONAL 0  // M807 Q default: 1 = cut on both Z strokes (double-edged tool), 0 = rapid return
+#endif
+
+#ifndef M800_EVACUATE_STROKES
+#define M800_EVACUATE_STROKES 0   // bidirectional only: leave the bore every n strokes, 0 = at end only
+#endif
+
+#ifndef M800_SPRING_PASSES
+#define M800_SPRING_PASSES 0  // extra strokes at X_final only (tool deflection), default of M807 P
+#endif
+
+#ifndef M800_ADAPTIVE_DEPTH
+#define M800_ADAPTIVE_DEPTH 0 // 1 = constant removed section per pass (sag zone), 0 = fixed step P
+#endif
+
+#ifndef M800_FINISH_STEP
+#define M800_FINISH_STEP 0.0f // radial step of the last pass to X_final (< P), 0 = off
+#endif
+
+#ifndef M800_BLEND
+#define M800_BLEND 0.0f       // blended retract/entry corners: corner size in mm, 0 = square corners
+#endif
+
+#ifndef M800_AIR_FEED_PERCENT
+#define M800_AIR_FEED_PERCENT 0  // feed for strokes that cannot reach material, % of Z max rate, 0 = off
+#endif
+
+#ifndef M800_MAX_PASSES
+#define M800_MAX_PASSES 128   // radial passes cached per cycle (pass table size, 8 bytes each)
+#endif
+
+#ifndef M800_MARKER_QUEUE
+#define M800_MARKER_QUEUE 32  // cycle moves tracked in the planner, limits how far ahead moves are queued
+#endif
+
+#ifndef M800_SEGMENT_BLOCKS
+#ifdef SEGMENT_BUFFER_SIZE
+#define M800_SEGMENT_BLOCKS SEGMENT_BUFFER_SIZE // blocks consumed behind a marked one before its steps have run
+#else
+#define M800_SEGMENT_BLOCKS 10
+#endif
+#endif
+
+#ifndef M800_STATUS_REPORT
+#define M800_STATUS_REPORT 1  // 1 = append cycle progress to the realtime status report
+#endif
+
+#ifndef M800_INSTRUMENT
+#define M800_INSTRUMENT 0     // 1 = time generation/mc_line()/phases, sample planner occupancy
+#endif
+
+#if M800_INSTRUMENT && !defined(M800_TICKS)
+#define M800_TICKS() hal.get_elapsed_ticks()  // timing source, eg. a cycle counter
+#define M800_TICKS_PER_MS 1
+#endif
+
+#ifndef M800_TRACE
+#define M800_TRACE 0          // 1 = one line per planner block (move trace), written synchronously
+#endif
+
+#ifndef M800_INDEX_AXIS
+#define M800_INDEX_AXIS -1    // rotary axis for multi-keyway indexing (M801), eg. A_AXIS, -1 = off
+#endif
+
+#ifndef M800_MAX_BANDS
+#define M800_MAX_BANDS 4      // Z bands per cycle (M802), single-edged tools only, 1 = off
+#endif
+
+#ifndef M800_ADAPTIVE_FEED
+#define M800_ADAPTIVE_FEED 0  // stroke feed from Z motor load, ceiling in % of F (eg. 150), 0 = off
+#endif
+
+#ifndef M800_LOAD_LOW
+#define M800_LOAD_LOW 0.4f    // adaptive feed: stroke load below this raises the feed 10%
+#endif
+
+#ifndef M800_LOAD_HIGH
+#define M800_LOAD_HIGH 0.8f   // adaptive feed: stroke load above this cuts the feed 25%
+#endif
+
+#ifndef M800_PROBE
+#define M800_PROBE 0          // 1 = probe the depth before the last level and trim it (M804), single-edged tools only
+#endif
+
+#ifndef M800_VALIDATE_ONCE
+#define M800_VALIDATE_ONCE 0  // 1 = soft limits checked once for the cycle envelope, not per move
+#endif
+
+#ifndef M800_PRESETS
+#define M800_PRESETS 0        // cycle presets stored in NVS ($450..), run with M810.., max 8, 0 = off
+#endif
+
+#ifndef M800_STATS
+#define M800_STATS 0          // 1 = production totals in NVS, reported by M800 E3
+#endif
+
+#ifndef M800_STATS_FLUSH
+#define M800_STATS_FLUSH 20   // totals saved to NVS every n completed cycles...
+#endif
+
+#ifndef M800_STATS_MINUTES
+#define M800_STATS_MINUTES 30 // ...or at the first completed cycle after this many minutes, and by E3
+#endif
+
+#ifndef M800_CHECKPOINT
+#define M800_CHECKPOINT 0     // K-1 progress saved to NVS every n depth levels, 0 = off
+#endif
+
+#ifndef M800_QUEUE
+#define M800_QUEUE 0          // batch queue entries (M805), run with M806, 0 = off
+#endif
+
+#ifndef M800_ASYNC_END
+#define M800_ASYNC_END 0      // 1 = return after queuing, report end asynchronously, 0 = sync at end
+#endif
+
+#define M800_Z_BANDS (M800_MAX_BANDS > 1)
+
+// Planner blocks one mc_line() may add: a backlash move goes in front
+#if ENABLE_BACKLASH_COMPENSATION
+#define M800_LINE_BLOCKS 2
+#else
+#define M800_LINE_BLOCKS 1
+#endif
+
+#if M800_PRESETS > 8
+#error "M800_PRESETS: at most 8 presets (M810..M817)"
 #endif
 
 #if M800_DEBUG
 #define M800_LOG(...) do { snprintf(dbg, sizeof(dbg), __VA_ARGS__); hal.stream.write(dbg); } while(0)
 #else
-#define M800_LOG(...)
+#define M800_LOG(...) do { } while(0)
 #endif
 
 #include "grbl/hal.h"
@@ -171,343 +715,3362 @@
 #include "grbl/state_machine.h"
 #include "grbl/nuts_bolts.h"
 #include "grbl/gcode.h"
+#include "grbl/planner.h"
+#include "grbl/system.h"
+#include "grbl/limits.h"
+#include "grbl/settings.h"
+#include "grbl/nvs_buffer.h"
 
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 
 #define M800_Internal 800
+#define M800_Index    801    // M801 P<count> [Q<angle step>] [L<order>]
+#define M800_Bands    802    // M802 P<Z offset> Q<length> | M802
+#define M800_Accel    803    // M803 P<Z acceleration> | M803
+#define M800_Probe    804    // M804 P<max trim> | M804
+#define M800_Enqueue  805    // M805 [X Y Z A] D.. Q.. S.. P.. R.. [L H J I] | M805
+#define M800_Run      806    // M806: run the queued cycles
+#define M800_Tool     807    // M807 [P<spring passes>] [Q<1 = bidirectional>] | M807
+#define M800_Preset   810    // M810..M817 [words]: M800 from preset 0..7
+
+#if M800_PRESETS
+#define M800_IS_PRESET(m) ((m) >= M800_Preset && (m) < M800_Preset + M800_PRESETS)
+#define M800_IS_CYCLE(m) ((m) == M800_Internal || M800_IS_PRESET(m))
+#else
+#define M800_IS_CYCLE(m) ((m) == M800_Internal)
+#endif
 
 extern stepper_t st;
 static user_mcode_ptrs_t user_mcode_prev;
 
+static on_execute_realtime_ptr on_execute_realtime;
+static on_reset_ptr on_reset;
+#if M800_STATUS_REPORT
+static on_realtime_report_ptr on_realtime_report;
+#endif
 
-// -----------------------------------------------------------------------------
-// HELPER: GET CURRENT MACHINE POSITION IN MM/DEGREES
-// -----------------------------------------------------------------------------
+// Cycle move types, see CYCLE GENERATOR
 
-static void m800_get_current_pos(float pos[N_AXIS])
+typedef enum {
+    Phase_Prepos = 0,
+    Phase_Safe,
+    Phase_Depth,
+    Phase_Entry,
+    Phase_Length,
+    Phase_BackX,
+    Phase_Band,
+    Phase_BackZ,
+    Phase_Probe,
+    Phase_Index,
+    Phase_Return,
+    Phase_Done
+} m800_phase_t;
+
+// Move template of each phase: planner data, the phase that normally
+// follows (m800_next_move() changes it where the cycle branches) and the
+// names for the status report and the debug log. The X and Z targets are
+// fields of the cycle, plus a multiple of the blend radius; m800_next_move()
+// only overrides the targets that depend on the band, the stroke direction
+// or the return.
+
+typedef enum {
+    Plan_G0 = 0,
+    Plan_Plunge,
+    Plan_Cut                    // feed of the current level (cut or air)
+} m800_plan_t;
+
+typedef struct {
+    uint8_t plan;               // m800_plan_t
+    uint8_t next;               // m800_phase_t
+    int8_t blend_x;             // X target += blend_x * blend
+    int8_t blend_z;             // Z target += blend_z * blend
+    uint16_t x;                 // offset of the X target in m800_cycle_t
+    uint16_t z;                 // offset of the Z target in m800_cycle_t
+#if M800_STATUS_REPORT || M800_INSTRUMENT
+    const char *code;
+#endif
+#if M800_DEBUG
+    const char *name;
+#endif
+} m800_template_t;
+
+#if (M800_STATUS_REPORT || M800_INSTRUMENT) && M800_DEBUG
+#define M800_MOVE(plan, next, x, bx, z, bz, code, name) { plan, next, bx, bz, offsetof(m800_cycle_t, x), offsetof(m800_cycle_t, z), code, name }
+#elif M800_STATUS_REPORT || M800_INSTRUMENT
+#define M800_MOVE(plan, next, x, bx, z, bz, code, name) { plan, next, bx, bz, offsetof(m800_cycle_t, x), offsetof(m800_cycle_t, z), code }
+#elif M800_DEBUG
+#define M800_MOVE(plan, next, x, bx, z, bz, code, name) { plan, next, bx, bz, offsetof(m800_cycle_t, x), offsetof(m800_cycle_t, z), name }
+#else
+#define M800_MOVE(plan, next, x, bx, z, bz, code, name) { plan, next, bx, bz, offsetof(m800_cycle_t, x), offsetof(m800_cycle_t, z) }
+#endif
+
+// Defined after m800_cycle_t, the targets are offsets into it
+static const m800_template_t m800_move[Phase_Done];
+
+typedef enum {
+    Marker_Move = 0,            // cycle move executing, a stroke physically done
+    Marker_End,                 // cycle <id> physically done
+    Marker_Cycle                // cycle physically done (M800_STATS)
+} m800_marker_type_t;
+
+typedef struct {
+    m800_marker_type_t type;
+    uint8_t phase;              // m800_phase_t of the move
+    uint8_t keyway;
+    bool stroke;                // last LENGTH move of a stroke (all Z bands cut)
+    uint16_t pass;
+    uint16_t rep;
+    uint16_t reps;              // strokes at this level, for the status report
+    uint32_t level;             // stroke: depth level in cycle order (m800_progress_t)
+    float time;                 // estimated move time (min)
+    uint32_t key;               // cycle key of the move, progress is only kept for the current cycle
+    uint32_t id;
+#if M800_STATS
+    uint8_t time_kind;          // move: cut, air or rapid time
+    uint8_t preset;             // Marker_Cycle: preset + 1, 0 = M800
+    uint8_t tool;               // Marker_Cycle: tool counter slot
+    uint32_t strokes;           // Marker_Cycle: strokes of the cycle
+#endif
+    uint_fast16_t blocks;       // planner blocks left to consume before the marked motion is done
+    bool consumed;              // the marked block has left the planner
+} m800_marker_t;
+
+static m800_marker_t markers[M800_MARKER_QUEUE];
+static uint_fast8_t marker_count = 0;
+static plan_block_t *marker_block = NULL;  // planner block executing at last poll
+
+// Last cutting stroke physically completed, for K resume
+
+typedef struct {
+    uint32_t key;               // parameter hash of the cycle it belongs to
+    int pass;                   // -1 = no stroke completed yet
+    int rep;
+    int keyway;
+    uint32_t level;             // depth levels before this one in cycle order, for the checkpoint interval
+    bool valid;
+} m800_progress_t;
+
+static m800_progress_t progress = {0};
+
+#if M800_CHECKPOINT
+
+// Progress saved to NVS, K-1 falls back to it after a power cycle
+
+static nvs_address_t checkpoint_address = 0;
+static m800_progress_t checkpoint = {0};
+static bool checkpoint_pending = false;
+
+// A stroke has been cut: save every M800_CHECKPOINT levels, and the first
+// stroke of a new cycle so an older checkpoint is never resumed by mistake.
+// Levels are counted in cycle order, so with M801 L1 every keyway to full
+// depth follows the previous one instead of restarting at pass 0.
+
+static void m800_checkpoint_stroke(void)
 {
-    for (uint_fast8_t axis = 0; axis < N_AXIS; axis++) {
-        bool axis_present = (settings.axis[axis].steps_per_mm > 0.0f) ||
-                            (settings.axis[axis].max_rate > 0.0f);
-        
-        if (axis_present) {
-            pos[axis] = sys.position[axis] / settings.axis[axis].steps_per_mm;
-        } else {
-            pos[axis] = 0.0f;
-        }
+    if(checkpoint.key != progress.key || progress.level >= checkpoint.level + M800_CHECKPOINT) {
+        checkpoint = progress;
+        checkpoint_pending = true;
     }
 }
 
+// Deferred from the realtime loop to a point where the planner holds the
+// most motion (or the cycle is queued), the stepper runs on meanwhile.
 
-// -----------------------------------------------------------------------------
-// HELPER: COPY POSITION FROM SOURCE TO TARGET (ALL AXES)
-// -----------------------------------------------------------------------------
-
-static void m800_copy_pos(float target[N_AXIS], const float source[N_AXIS])
+static void m800_checkpoint_write(void)
 {
-    for (uint_fast8_t axis = 0; axis < N_AXIS; axis++) {
-        target[axis] = source[axis];
-    }
+    checkpoint_pending = false;
+
+    if(checkpoint_address)
+        hal.nvs.memcpy_to_nvs(checkpoint_address, (uint8_t *)&checkpoint, sizeof(m800_progress_t), true);
 }
 
+// Checkpoints reach the store when written, not only the NVS RAM buffer
 
-// -----------------------------------------------------------------------------
-// CHECK
-// -----------------------------------------------------------------------------
+static inline bool m800_checkpoint_durable(void)
+{
+    return hal.nvs.type == NVS_EEPROM || hal.nvs.type == NVS_FRAM;
+}
 
-static user_mcode_type_t m800_check(user_mcode_t mcode)
+// Once after power-up, from the first cycle
+
+static void m800_checkpoint_warn(void)
 {
-    if(mcode == M800_Internal)
-        return UserMCode_NoValueWords;
+    static bool warned = false;
 
-    return user_mcode_prev.check ?
-           user_mcode_prev.check(mcode) :
-           UserMCode_Unsupported;
+    if(!warned && !m800_checkpoint_durable()) {
+        warned = true;
+        report_message("M800: NVS is not EEPROM or FRAM, checkpoints are lost on power loss.", Message_Warning);
+    }
 }
 
+// $I: the checkpoints do not survive a power loss on this controller
 
-// -----------------------------------------------------------------------------
-// VALIDATE
-// -----------------------------------------------------------------------------
+static on_report_options_ptr on_report_options;
 
-static status_code_t m800_validate(parser_block_t *gc_block)
+static void m800_report_options(bool newopt)
 {
-    if(gc_block->user_mcode != M800_Internal)
-        return user_mcode_prev.validate ?
-               user_mcode_prev.validate(gc_block) :
-               Status_Unhandled;
+    on_report_options(newopt);
 
-    if(gc_block->values.d <= 0.0f) return Status_InvalidStatement;
-    if(gc_block->values.q <= 0.0f) return Status_InvalidStatement;
-    if(gc_block->values.s <= 0.0f) return Status_InvalidStatement;
-    if(gc_block->values.p <= 0.0f) return Status_InvalidStatement;
-    if(gc_block->values.r <= 0.0f) return Status_InvalidStatement;
+    if(!newopt)
+        hal.stream.write("[MSG:Warning: M800 checkpoints in NVS RAM buffer only, not power-loss safe]\r\n");
+}
 
-    if(gc_block->values.p > gc_block->values.d)
-        return Status_InvalidStatement;
+static void m800_checkpoint_load(void)
+{
+    if(checkpoint_address &&
+        hal.nvs.memcpy_from_nvs((uint8_t *)&checkpoint, checkpoint_address, sizeof(m800_progress_t), true) == NVS_TransferResult_OK &&
+         checkpoint.valid)
+        progress = checkpoint;
+}
 
-    if(gc_block->words.l && gc_block->values.l < 1)
-        return Status_InvalidStatement;
+#endif
 
-    if(gc_block->words.h)
-        if(gc_block->values.h != 0.0f && gc_block->values.h != 1.0f)
-            return Status_InvalidStatement;
+// Cycle progress for the status report
+typedef struct {
+    int passes;
+    int keyways;
+    float remaining;            // estimated time of the moves not yet done (min)
+#if M800_TRACE
+    float total;                // estimated cycle time (min)
+#endif
+} m800_status_t;
 
-    if(gc_state.feed_rate <= 0.0f)
+static m800_status_t status = {0};
+
+// Z load source for the adaptive feed, see keyway.h
+static keyway_load_ptr load_source = NULL;
+
+#if M800_ADAPTIVE_FEED
+
+// Adaptive stroke feed: peak load of the stroke being cut and the feed
+// for the strokes queued from now on.
+typedef struct {
+    float peak;                 // highest load of the current stroke, < 0 = no sample
+    float feed;
+    float min;                  // 50% of F
+    float max;                  // M800_ADAPTIVE_FEED % of F, at most the Z max rate
+} m800_adapt_t;
+
+static m800_adapt_t adapt = {0};
+
+// A LENGTH stroke is done: raise the feed after a light stroke, cut it when
+// the load came close to the stall threshold. Strokes already queued keep
+// their feed, the planner lookahead delays the change by a few strokes.
+
+static void m800_adapt_stroke(void)
+{
+#if M800_DEBUG
+    char dbg[128];
+#endif
+
+    if(adapt.peak < 0.0f)
+        return;
+
+    if(adapt.peak >= M800_LOAD_HIGH)
+        adapt.feed = fmaxf(adapt.feed * 0.75f, adapt.min);
+    else if(adapt.peak < M800_LOAD_LOW)
+        adapt.feed = fminf(adapt.feed * 1.1f, adapt.max);
+
+    M800_LOG("M800 ADAPT: load=%.2f feed=%.0f\r\n", adapt.peak, adapt.feed);
+
+    adapt.peak = -1.0f;
+}
+
+#endif
+
+#if M800_Z_BANDS
+
+// Z bands after the M800 Q band, set by M802 for the following M800 blocks
+typedef struct {
+    uint8_t count;
+    float offset[M800_MAX_BANDS - 1];   // from Z_start into the bore
+    float length[M800_MAX_BANDS - 1];
+} m800_bands_t;
+
+static m800_bands_t band_setup = {0};
+
+#endif
+
+// Z acceleration of the cycle moves (mm/min²), 0 = machine setting, set by M803
+static float z_accel_setup = 0.0f;
+
+// Tool of the following M800 blocks, set by M807
+typedef struct {
+    uint16_t spring;                // extra strokes at X_final
+    bool bidirectional;             // double-edged tool, cuts on both Z strokes
+} m800_tool_setup_t;
+
+static m800_tool_setup_t tool_setup = {
+    .spring = M800_SPRING_PASSES,
+    .bidirectional = M800_BIDIRECTIONAL
+};
+
+#if M800_PROBE
+// Largest depth trim accepted from the probe, 0 = no probing, set by M804
+static float probe_setup = 0.0f;
+#endif
+
+#if M800_INDEX_AXIS >= 0
+
+// Multi-keyway indexing, set by M801 for the following M800 blocks
+typedef struct {
+    uint16_t count;             // keyways, 1 = indexing off
+    float step;                 // rotary step between keyways
+    bool by_keyway;             // L1: each keyway to full depth in turn
+} m800_index_t;
+
+static m800_index_t index_setup = { .count = 1 };
+
+#endif
+
+// Validated words of one cycle, from an M800 block or a queue entry
+typedef struct {
+    float d, q, s, p, r;
+    float j;                    // radial clearance, 0 = full retract
+    float i;                    // plunge feed, 0 = F
+    float feed;                 // F when the block was read
+    int l;
+    bool h;
+    uint8_t preset;             // M81n: preset + 1, 0 = M800 (statistics)
+} m800_job_t;
+
+#if M800_QUEUE
+
+// Batch queue, filled by M805 and run by M806
+typedef struct {
+    float start[N_AXIS];        // start position (machine coordinates)
+    m800_job_t job;
+} m800_entry_t;
+
+static m800_entry_t queue[M800_QUEUE];
+static uint_fast8_t queue_count = 0;
+
+#endif
+
+#if M800_ASYNC_END
+static uint32_t cycle_id = 0;
+#endif
+
+
+#if !M800_PARSER_START
+
+// -----------------------------------------------------------------------------
+// HELPER: GET CURRENT MACHINE POSITION IN MM/DEGREES
+// -----------------------------------------------------------------------------
+
+static void m800_get_current_pos(float pos[N_AXIS])
+{
+    for (uint_fast8_t axis = 0; axis < N_AXIS; axis++) {
+        bool axis_present = (settings.axis[axis].steps_per_mm > 0.0f) ||
+                            (settings.axis[axis].max_rate > 0.0f);
+        
+        if (axis_present) {
+            pos[axis] = sys.position[axis] / settings.axis[axis].steps_per_mm;
+        } else {
+            pos[axis] = 0.0f;
+        }
+    }
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// HELPER: GET CYCLE START POSITION (ALL AXES)
+// -----------------------------------------------------------------------------
+//  M800_PARSER_START = 1: commanded position of the parser, already in machine
+//  coordinates with work offsets applied. Moves still in the planner are not
+//  waited for, so the cycle blends into the preceding motion.
+//  M800_PARSER_START = 0: wait for the planner to drain, then read the actual
+//  machine position.
+
+static void m800_get_start_pos(float pos[N_AXIS])
+{
+#if M800_PARSER_START
+    memcpy(pos, gc_state.position, sizeof(float) * N_AXIS);
+#else
+    protocol_buffer_synchronize();
+    m800_get_current_pos(pos);
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// HELPER: COPY POSITION FROM SOURCE TO TARGET (ALL AXES)
+// -----------------------------------------------------------------------------
+
+static void m800_copy_pos(float target[N_AXIS], const float source[N_AXIS])
+{
+    for (uint_fast8_t axis = 0; axis < N_AXIS; axis++) {
+        target[axis] = source[axis];
+    }
+}
+
+
+#if M800_INSTRUMENT
+
+// -----------------------------------------------------------------------------
+// INSTRUMENTATION (M800_INSTRUMENT)
+// -----------------------------------------------------------------------------
+//  Per cycle:
+//      gen     time spent in m800_next_move()
+//      line    time spent in mc_line(), including waiting for planner room
+//  Per phase:
+//      exec    executed (wall) time, from one move marker firing to the next,
+//              so the resolution is one realtime loop pass
+//      min/avg planner blocks already queued when a move of the phase was
+//              added
+//      dry     moves added to an empty planner: motion had stopped because
+//              generation did not keep up
+//  Collected for the last cycle, reported after CYCLE END and by M800 E2.
+
+typedef struct {
+    uint32_t moves;
+    uint64_t gen_ticks;
+    uint64_t line_ticks;
+    uint32_t last_done;             // ticks when the last move marker fired
+    uint64_t exec_ticks[Phase_Done];
+    uint32_t phase_moves[Phase_Done];
+    uint32_t blocks_sum[Phase_Done];
+    uint16_t blocks_min[Phase_Done];
+    uint32_t dry[Phase_Done];
+} m800_instr_t;
+
+static m800_instr_t instr = {0};
+
+static void m800_instr_reset(void)
+{
+    memset(&instr, 0, sizeof(m800_instr_t));
+
+    for(uint_fast8_t phase = 0; phase < Phase_Done; phase++)
+        instr.blocks_min[phase] = UINT16_MAX;
+
+    instr.last_done = M800_TICKS();
+}
+
+// A move of this phase was queued with 'blocks' blocks already in the planner
+
+static void m800_instr_queued(m800_phase_t phase, uint32_t gen_ticks, uint32_t line_ticks, uint_fast16_t blocks)
+{
+    instr.moves++;
+    instr.gen_ticks += gen_ticks;
+    instr.line_ticks += line_ticks;
+    instr.phase_moves[phase]++;
+    instr.blocks_sum[phase] += blocks;
+    if(blocks < instr.blocks_min[phase])
+        instr.blocks_min[phase] = (uint16_t)blocks;
+    if(blocks == 0)
+        instr.dry[phase]++;
+}
+
+// A move of this phase has been executed
+
+static void m800_instr_executed(m800_phase_t phase)
+{
+    uint32_t now = M800_TICKS();
+
+    instr.exec_ticks[phase] += now - instr.last_done;
+    instr.last_done = now;
+}
+
+static void m800_instr_report(void)
+{
+    char msg[96];
+
+    snprintf(msg, sizeof(msg), "M800 STATS: moves=%lu gen=%lums line=%lums\r\n",
+             (unsigned long)instr.moves,
+             (unsigned long)(instr.gen_ticks / M800_TICKS_PER_MS),
+             (unsigned long)(instr.line_ticks / M800_TICKS_PER_MS));
+    hal.stream.write(msg);
+
+    for(uint_fast8_t phase = 0; phase < Phase_Done; phase++) {
+        if(instr.phase_moves[phase]) {
+            snprintf(msg, sizeof(msg), "M800 STATS %s: moves=%lu exec=%lums blocks min=%u avg=%.1f dry=%lu\r\n",
+                     m800_move[phase].code, (unsigned long)instr.phase_moves[phase],
+                     (unsigned long)(instr.exec_ticks[phase] / M800_TICKS_PER_MS),
+                     (unsigned)instr.blocks_min[phase],
+                     (float)instr.blocks_sum[phase] / (float)instr.phase_moves[phase],
+                     (unsigned long)instr.dry[phase]);
+            hal.stream.write(msg);
+        }
+    }
+}
+
+#endif
+
+
+#if M800_STATS
+
+// -----------------------------------------------------------------------------
+// PRODUCTION STATISTICS (M800_STATS)
+// -----------------------------------------------------------------------------
+//  Totals over every cycle run, kept in RAM and saved to NVS every
+//  M800_STATS_FLUSH completed cycles or M800_STATS_MINUTES, and by M800 E3
+//  (deferred like the checkpoint). The move counters are a
+//  few adds when a move is queued or its marker fires, nothing is written
+//  until M800 E3 asks for it. Times are the estimated times of the moves
+//  executed. Per tool only completed cycles are counted.
+
+#define M800_STATS_TOOLS 4      // tools with their own counters
+
+typedef enum {
+    Time_Cut = 0,               // feed moves: strokes and plunges
+    Time_Air,                   // air-cut strokes
+    Time_Rapid
+} m800_time_t;
+
+typedef struct {
+    uint32_t tool;
+    uint32_t cycles;
+    uint32_t strokes;
+} m800_tool_stats_t;
+
+typedef struct {
+    uint32_t cycles;                            // completed
+    uint32_t strokes;                           // executed
+    uint32_t time_ms[Time_Rapid + 1];
+    uint32_t moves;                             // planner blocks queued
+    uint32_t blocks;                            // planner blocks after each one was queued (sum)
+    uint32_t preset_cycles[M800_PRESETS + 1];   // [0] = M800 and M806, [n + 1] = M81n
+    uint8_t tools;
+    m800_tool_stats_t tool[M800_STATS_TOOLS];
+} m800_stats_t;
+
+static nvs_address_t stats_address = 0;
+static m800_stats_t stats = {0};
+static bool stats_loaded = false;
+static bool stats_pending = false;
+static uint_fast16_t stats_unsaved = 0;     // completed cycles since the last save
+static uint32_t stats_saved_ms = 0;
+
+// From NVS at the first cycle or query after power-up
+
+static void m800_stats_load(void)
+{
+    if(stats_loaded)
+        return;
+
+    stats_loaded = true;
+
+    if(!stats_address ||
+        hal.nvs.memcpy_from_nvs((uint8_t *)&stats, stats_address, sizeof(m800_stats_t), true) != NVS_TransferResult_OK)
+        memset(&stats, 0, sizeof(m800_stats_t));
+}
+
+static void m800_stats_write(void)
+{
+    stats_pending = false;
+    stats_unsaved = 0;
+    stats_saved_ms = hal.get_elapsed_ticks();
+
+    if(stats_address)
+        hal.nvs.memcpy_to_nvs(stats_address, (uint8_t *)&stats, sizeof(m800_stats_t), true);
+}
+
+// Counter slot of the current tool, M800_STATS_TOOLS if the table is full
+
+static uint8_t m800_stats_tool(void)
+{
+    uint32_t tool = gc_state.tool->tool_id;
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < stats.tools; idx++) {
+        if(stats.tool[idx].tool == tool)
+            return idx;
+    }
+
+    if(idx < M800_STATS_TOOLS) {
+        stats.tool[idx].tool = tool;
+        stats.tools++;
+    }
+
+    return idx;
+}
+
+static void m800_stats_cycle(const m800_marker_t *marker)
+{
+    stats.cycles++;
+    stats.preset_cycles[marker->preset]++;
+
+    if(marker->tool < M800_STATS_TOOLS) {
+        stats.tool[marker->tool].cycles++;
+        stats.tool[marker->tool].strokes += marker->strokes;
+    }
+
+    if(++stats_unsaved >= M800_STATS_FLUSH ||
+        hal.get_elapsed_ticks() - stats_saved_ms >= M800_STATS_MINUTES * 60000UL)
+        stats_pending = true;
+}
+
+static void m800_stats_report(void)
+{
+    char msg[112];
+
+    m800_stats_load();
+
+    snprintf(msg, sizeof(msg), "M800 TOTAL: cycles=%lu strokes=%lu cut=%lus air=%lus rapid=%lus blocks avg=%.1f\r\n",
+             (unsigned long)stats.cycles, (unsigned long)stats.strokes,
+             (unsigned long)(stats.time_ms[Time_Cut] / 1000UL),
+             (unsigned long)(stats.time_ms[Time_Air] / 1000UL),
+             (unsigned long)(stats.time_ms[Time_Rapid] / 1000UL),
+             stats.moves ? (float)stats.blocks / (float)stats.moves : 0.0f);
+    hal.stream.write(msg);
+
+    for(uint_fast8_t idx = 0; idx <= M800_PRESETS; idx++) {
+        if(idx == 0)
+            snprintf(msg, sizeof(msg), "M800 TOTAL M800: cycles=%lu\r\n", (unsigned long)stats.preset_cycles[0]);
+        else
+            snprintf(msg, sizeof(msg), "M800 TOTAL M81%u: cycles=%lu\r\n", (unsigned)(idx - 1), (unsigned long)stats.preset_cycles[idx]);
+        hal.stream.write(msg);
+    }
+
+    for(uint_fast8_t idx = 0; idx < stats.tools; idx++) {
+        snprintf(msg, sizeof(msg), "M800 TOTAL T%lu: cycles=%lu strokes=%lu\r\n",
+                 (unsigned long)stats.tool[idx].tool, (unsigned long)stats.tool[idx].cycles,
+                 (unsigned long)stats.tool[idx].strokes);
+        hal.stream.write(msg);
+    }
+}
+
+static void m800_stats_clear(void)
+{
+    memset(&stats, 0, sizeof(m800_stats_t));
+    stats_loaded = true;
+
+    m800_stats_write();
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// PLANNER MARKERS
+// -----------------------------------------------------------------------------
+//  A marker tags the block just queued. The number of blocks in the planner
+//  is recorded when the marker is pushed and counted down by every block
+//  the planner consumes, counted along the block ring from the one seen at
+//  the previous poll, so none is missed while the realtime loop is held up.
+//
+//  The planner consumes a block once the stepper has prepared all of its
+//  step segments, the segment buffer still holds up to M800_SEGMENT_BLOCKS
+//  of them. Consumed, a move is the one being executed (status report) and
+//  its time is taken off the remaining time. Strokes, the asynchronous
+//  CYCLE END report and the end of cycle statistics are done only once
+//  M800_SEGMENT_BLOCKS more blocks have been consumed behind them (every
+//  block has at least one segment), or the planner is empty and the
+//  machine idle: then the motion has physically finished. So the last
+//  stroke recorded for a resume (K word) has been cut to its end.
+
+#if M800_ASYNC_END
+
+static void m800_report_end(uint32_t id)
+{
+    char msg[40];
+
+    snprintf(msg, sizeof(msg), "M800 CYCLE END ID=%lu\r\n", (unsigned long)id);
+    hal.stream.write(msg);
+}
+
+#endif
+
+// The marked block has left the planner, its steps are being executed
+
+static void m800_marker_consumed(m800_marker_t *marker)
+{
+    marker->consumed = true;
+
+    if(marker->type == Marker_Move) {
+        status.remaining -= marker->time;
+#if M800_INSTRUMENT
+        m800_instr_executed((m800_phase_t)marker->phase);
+#endif
+#if M800_ADAPTIVE_FEED
+        if(marker->phase == Phase_Length)
+            m800_adapt_stroke();
+#endif
+#if M800_STATS
+        stats.time_ms[marker->time_kind] += (uint32_t)(marker->time * 60000.0f);
+#endif
+    }
+}
+
+// Moves other than strokes have nothing left to do once consumed
+
+static inline bool m800_marker_waits(const m800_marker_t *marker)
+{
+    return marker->type != Marker_Move || marker->stroke;
+}
+
+// The marked motion has physically finished
+
+static void m800_marker_done(const m800_marker_t *marker)
+{
+    switch(marker->type) {
+
+        case Marker_Move:
+#if M800_STATS
+            stats.strokes++;
+#endif
+            if(marker->key == progress.key) {
+                progress.pass = marker->pass;
+                progress.rep = marker->rep;
+                progress.keyway = marker->keyway;
+                progress.level = marker->level;
+#if M800_CHECKPOINT
+                m800_checkpoint_stroke();
+#endif
+            }
+            break;
+
+#if M800_ASYNC_END
+        case Marker_End:
+            m800_report_end(marker->id);
+  #if M800_INSTRUMENT
+            m800_instr_report();
+  #endif
+            break;
+#endif
+
+#if M800_STATS
+        case Marker_Cycle:
+            m800_stats_cycle(marker);
+            break;
+#endif
+
+        default:
+            break;
+    }
+}
+
+// Polled from the realtime loop: count the blocks consumed since the last
+// poll, then handle every marker whose block is consumed or whose motion
+// has finished. The counts grow with the queue order, so markers finish in
+// the order they were pushed.
+
+static void m800_marker_poll(void)
+{
+    plan_block_t *block = plan_get_current_block();
+    uint_fast16_t consumed = 0, pending;
+    uint_fast8_t idx, kept = 0;
+
+    if(marker_count == 0)
+        return;
+
+    pending = markers[marker_count - 1].blocks;
+
+    // Empty planner: every marked block is consumed, the last one last
+    if(block == NULL)
+        consumed = pending > M800_SEGMENT_BLOCKS ? pending - M800_SEGMENT_BLOCKS : 0;
+    else if(marker_block != NULL) {
+        for(plan_block_t *next = marker_block; next != block && consumed < pending; next = next->next)
+            consumed++;
+    }
+
+    marker_block = block;
+
+    // Empty planner and idle machine: the last segment has been executed
+    if(block == NULL && state_get() == STATE_IDLE)
+        consumed = pending;
+
+    for(idx = 0; idx < marker_count; idx++) {
+
+        m800_marker_t *marker = &markers[idx];
+
+        marker->blocks = marker->blocks > consumed ? marker->blocks - consumed : 0;
+
+        if(!marker->consumed && marker->blocks <= M800_SEGMENT_BLOCKS)
+            m800_marker_consumed(marker);
+
+        if(marker->blocks == 0 && m800_marker_waits(marker))
+            m800_marker_done(marker);
+        else if(!marker->consumed || m800_marker_waits(marker))
+            markers[kept++] = *marker;
+    }
+
+    marker_count = kept;
+}
+
+#if M800_STATUS_REPORT || M800_ADAPTIVE_FEED
+
+// The cycle move being executed: the first one still in the planner
+
+static const m800_marker_t *m800_marker_current(void)
+{
+    for(uint_fast8_t idx = 0; idx < marker_count; idx++) {
+        if(!markers[idx].consumed)
+            return markers[idx].type == Marker_Move ? &markers[idx] : NULL;
+    }
+
+    return NULL;
+}
+
+#endif
+
+// Called right after the marked move has been queued.
+// Every block in the planner at this point (including the marked one) has
+// to be consumed before the move is executing, M800_SEGMENT_BLOCKS more
+// before it has been physically completed.
+// Returns a cleared marker to fill in, or NULL if the queue is full.
+
+static m800_marker_t *m800_marker_push(m800_marker_type_t type)
+{
+    m800_marker_t *marker;
+
+    if(marker_count == M800_MARKER_QUEUE)
+        return NULL;
+
+    if(marker_count == 0)
+        marker_block = plan_get_current_block();
+
+    marker = &markers[marker_count++];
+    memset(marker, 0, sizeof(m800_marker_t));
+    marker->type = type;
+    marker->blocks = plan_get_block_buffer_count() + M800_SEGMENT_BLOCKS;
+
+    return marker;
+}
+
+#if M800_ASYNC_END
+
+static void m800_end_enqueue(uint32_t id)
+{
+    // The pump leaves a slot free for this, but fall back to synchronous
+    // completion rather than losing a report.
+    m800_marker_t *marker = m800_marker_push(Marker_End);
+
+    if(marker)
+        marker->id = id;
+    else {
+        protocol_buffer_synchronize();
+        m800_marker_poll();
+        m800_report_end(id);
+    }
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// DEPTH SCHEDULE
+// -----------------------------------------------------------------------------
+//  Radial passes 1..passes run from X_new_start to X_final.
+//
+//  Fixed schedule: step P, last roughing pass clamped.
+//
+//  Adaptive schedule (M800_ADAPTIVE_DEPTH): inside the sag zone the tool only
+//  cuts the two arcs under its corners, so the depth of each pass is chosen
+//  to remove the same cross-section as a full-width pass of depth P (S * P).
+//  Past the sag zone the section grows linearly with depth and the step is P
+//  again. Early passes get a useful chip load and the pass count drops
+//  without raising the peak load on the tool.
+//
+//  Both schedules end with an optional finishing pass of M800_FINISH_STEP.
+
+typedef struct {
+    float X_new_start;  // sag-compensated start X (edge corners on the bore)
+    float X_rough;      // depth of the last roughing pass
+    float X_final;      // final depth
+    float P;            // nominal radial step
+    float Rbore;        // bore radius
+    float halfC;        // half tool width
+    float section;      // removed cross-section per pass, S * P (adaptive)
+    int rough;          // number of roughing passes
+    int passes;         // total number of radial passes (roughing + finish)
+    bool adaptive;
+} m800_depths_t;
+
+// Integral of sqrt(R² - y²) from 0 to y
+
+static float m800_arc_integral(float R, float y)
+{
+    return 0.5f * (y * sqrtf(R * R - y * y) + R * R * asinf(y / R));
+}
+
+// Cross-section removed from the bore wall with the cutting edge at X
+// (strip |y| <= halfC, between the bore circle and the tool edge).
+
+static float m800_section(const m800_depths_t *d, float X)
+{
+    float y0 = X >= d->Rbore ? 0.0f : sqrtf(d->Rbore * d->Rbore - X * X);
+
+    if(y0 >= d->halfC)
+        return 0.0f;
+
+    return 2.0f * (X * (d->halfC - y0) -
+                   (m800_arc_integral(d->Rbore, d->halfC) - m800_arc_integral(d->Rbore, y0)));
+}
+
+// Edge X removing the given cross-section from the bore wall
+
+static float m800_section_depth(const m800_depths_t *d, float section)
+{
+    float full = m800_section(d, d->Rbore);
+
+    if(section >= full)
+        return d->Rbore + (section - full) / (2.0f * d->halfC);
+
+    float lo = d->X_new_start, hi = d->Rbore;
+
+    for(uint_fast8_t i = 0; i < 24; i++) {
+        float mid = 0.5f * (lo + hi);
+        if(m800_section(d, mid) < section)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return hi;
+}
+
+static void m800_depths_init(m800_depths_t *d, float Rbore, float halfC,
+                             float X_new_start, float X_final, float P)
+{
+    float finish = M800_FINISH_STEP;
+
+    d->X_new_start = X_new_start;
+    d->X_final = X_final;
+    d->P = P;
+    d->Rbore = Rbore;
+    d->halfC = halfC;
+    d->section = 2.0f * halfC * P;
+    d->adaptive = M800_ADAPTIVE_DEPTH && halfC > 0.0f;
+
+    if(finish <= 0.0f || finish >= P || finish >= X_final - X_new_start)
+        finish = 0.0f;
+
+    d->X_rough = X_final - finish;
+
+    if(d->adaptive)
+        d->rough = (int)ceilf(m800_section(d, d->X_rough) / d->section);
+    else
+        d->rough = (int)ceilf((d->X_rough - X_new_start) / P);
+
+    if(d->rough < 1)
+        d->rough = 1;
+
+    d->passes = d->rough + (finish > 0.0f ? 1 : 0);
+}
+
+// X target of radial pass 1..passes
+
+static float m800_depth(const m800_depths_t *d, int pass)
+{
+    if(pass > d->rough)
+        return d->X_final;
+
+    float X = d->adaptive
+               ? m800_section_depth(d, pass * d->section)
+               : d->X_new_start + pass * d->P;
+
+    return X > d->X_rough ? d->X_rough : X;
+}
+
+
+// -----------------------------------------------------------------------------
+// PASS TABLE
+// -----------------------------------------------------------------------------
+//  Built once when the cycle starts: one entry per level, [0] = safety pass,
+//  the last level kept apart. The generator, the estimate and the resume
+//  logic read depth, repetitions and stroke feed through m800_pass(), so no
+//  geometry is evaluated per move. Levels past the table are computed from
+//  the schedule when first asked for and cached by pass index, one slot for
+//  even and one for odd levels: the level being queued and the level being
+//  executed (adaptive feed) are adjacent and do not evict each other.
+
+typedef enum {
+    Feed_Air = 0,                   // no material at this depth
+    Feed_Cut
+} m800_feed_t;
+
+typedef struct {
+    float X;                        // X target of the level
+    uint16_t reps;                  // strokes at this level
+    uint8_t feed;                   // m800_feed_t
+} m800_pass_t;
+
+static m800_pass_t pass_table[M800_MAX_PASSES];
+static m800_pass_t pass_last;           // level d->passes, trimmed by the probe
+static m800_depths_t pass_depths;       // schedule of levels past the table
+static int pass_reps, pass_spring;
+static m800_pass_t pass_cache[2];       // levels past the table, [pass & 1]
+static int pass_cached[2];              // pass index of each slot, -1 = empty
+
+static void m800_pass_eval(m800_pass_t *level, const m800_depths_t *d, int Lreps, int pass)
+{
+    level->X = pass == 0 ? d->X_new_start : m800_depth(d, pass);
+
+    // Safety pass once, roughing levels L times, spring passes at X_final only
+    level->reps = pass == 0
+                   ? 1
+                   : (pass == d->passes ? Lreps + pass_spring : Lreps);
+
+    // Strokes that cannot reach material run at the air-cut feed
+    level->feed = pass == 0 || m800_section(d, level->X) <= 0.0f ? Feed_Air : Feed_Cut;
+}
+
+static void m800_pass_table_init(const m800_depths_t *d, int Lreps, int spring)
+{
+    pass_depths = *d;
+    pass_reps = Lreps;
+    pass_spring = spring;
+
+    for(int pass = 0; pass < d->passes && pass < M800_MAX_PASSES; pass++)
+        m800_pass_eval(&pass_table[pass], d, Lreps, pass);
+
+    m800_pass_eval(&pass_last, d, Lreps, d->passes);
+
+    pass_cached[0] = pass_cached[1] = -1;
+}
+
+// Level 0..passes, a level past the table is valid until a level of the
+// same parity is asked for
+
+static const m800_pass_t *m800_pass(int pass)
+{
+    if(pass >= pass_depths.passes)
+        return &pass_last;
+
+    if(pass < M800_MAX_PASSES)
+        return &pass_table[pass];
+
+    m800_pass_t *level = &pass_cache[pass & 1];
+
+    if(pass_cached[pass & 1] != pass) {
+        m800_pass_eval(level, &pass_depths, pass_reps, pass);
+        pass_cached[pass & 1] = pass;
+    }
+
+    return level;
+}
+
+
+// -----------------------------------------------------------------------------
+// CYCLE GENERATOR
+// -----------------------------------------------------------------------------
+//  The cycle is a resumable generator: m800_next_move() produces one move at
+//  a time from the state in m800_cycle_t, and m800_pump() queues moves only
+//  while the planner has room. The pump runs from the realtime loop
+//  (grbl.on_execute_realtime) while m800_execute() waits for the cycle to be
+//  fully queued, so moves are fed at the rate the planner drains and status
+//  reports and realtime commands keep being serviced on long cycles.
+//
+//  Moves of one stroke (unidirectional):
+//
+//      SAFE    G0  X_back,   Z_start + R
+//      DEPTH   G1  X_target               (plunge feed)
+//      LENGTH  G1  Z_start + Q            (stroke feed, air-cut feed if no material)
+//      BACKX   G0  X_back
+//      BACKZ   G0  Z_start + R
+//
+//  Bidirectional: DEPTH + LENGTH alternate direction, BACKX + BACKZ only for
+//  chip evacuation and when the cycle ends at the far end.
+//
+//  The planner data, the target, the usual successor and the names of every
+//  phase come from the m800_move[] template; m800_next_move() only handles
+//  the exceptions (band ends, far end, return home) and the branches of the
+//  cycle (level, band, keyway, return).
+
+typedef struct {
+    uint32_t queued;
+    uint32_t skipped;
+} m800_blocks_t;
+
+typedef struct {
+    // Geometry and parameters, resolved when the cycle starts
+    float X_start;
+    float Z_start;
+    float X_new_start;
+    float Z_cut;                    // Z_start + Q (Q negative)
+    int bands;                      // Z bands, band 0 = Z_safe to Z_cut
+    float band_start[M800_MAX_BANDS];
+    float band_end[M800_MAX_BANDS];
+    float Z_safe;                   // Z_start + R
+    float C;                        // radial retract clearance, 0 = full retract
+    int passes;                     // radial passes, levels 0..passes (m800_pass)
+    int keyways;                    // keyways cut in this cycle (M801), 1 = single
+    bool by_keyway;                 // each keyway to full depth, else level by level
+    bool return_home;
+    bool bidirectional;             // cut on both Z strokes (M807 Q1)
+    uint32_t key;                   // parameter hash (K resume)
+#if M800_INDEX_AXIS >= 0
+    float A_start;                  // rotary position of keyway 0
+    float A_step;
+#endif
+    plan_line_data_t plan_g0;
+    plan_line_data_t plan_g1;       // Z stroke feed
+    plan_line_data_t plan_air;      // air-cut stroke feed
+    plan_line_data_t plan_plunge;   // X plunge feed
+    // Progress
+    bool active;                    // moves left to queue
+    bool pumping;                   // m800_pump() running, mc_line() re-enters the realtime loop
+    bool preview;                   // estimate run only, no debug output
+    bool aborted;                   // mc_line() failed or reset
+    bool last_stroke;               // bidirectional: no strokes after the current one
+    bool at_far_end;                // tool at Z_cut
+    m800_phase_t phase;             // next move to generate
+    int pass;                       // 0 = safety pass, 1..passes = radial passes
+    int rep;
+    int keyway;                     // 0..keyways-1
+    int band;                       // Z band of the current stroke
+    int reps;                       // strokes at the current level
+    int strokes;                    // strokes generated so far
+    m800_phase_t move_phase;        // phase/pass/rep of the last generated move
+    int move_pass;
+    int move_rep;
+    int move_keyway;
+    int move_band;
+    float X_target;
+    float X_back;
+    float blend;                    // entry corner of the current stroke (M800_BLEND)
+    float Z_accel;                  // Z acceleration override (mm/min²), 0 = off
+#if M800_PROBE
+    float probe;                    // max trim, 0 = do not probe
+    bool probed;
+#endif
+    plan_line_data_t *plan_cut;     // feed of the LENGTH strokes at the current level
+    float target[N_AXIS];           // move buffer: only X/Z change, other axes held from the start
+    float X_last;                   // last commanded X/Z
+    float Z_last;
+#if M800_INDEX_AXIS >= 0
+    float A_last;                   // last commanded rotary position
+#endif
+    m800_blocks_t blocks;
+} m800_cycle_t;
+
+static m800_cycle_t cycle = {0};
+
+static const m800_template_t m800_move[Phase_Done] = {
+    //                         plan         next          X target, blend Z target, blend
+    [Phase_Prepos] = M800_MOVE(Plan_G0,     Phase_Safe,   X_new_start, 0, Z_safe, 0,  "POS",   "G0 SAG POS"),
+    [Phase_Safe]   = M800_MOVE(Plan_G0,     Phase_Depth,  X_back, 1,      Z_safe, 0,  "SAFE",  "G0 SAFE:  "),
+    [Phase_Depth]  = M800_MOVE(Plan_Plunge, M800_BLEND > 0.0f ? Phase_Entry : Phase_Length,
+                                                          X_target, -1,   Z_last, 0,  "DEPTH", "G1 DEPTH: "),
+    [Phase_Entry]  = M800_MOVE(Plan_Plunge, Phase_Length, X_target, 0,    Z_last, -1, "ENTRY", "G1 ENTRY: "),
+    [Phase_Length] = M800_MOVE(Plan_Cut,    Phase_BackX,  X_last, 0,      Z_last, 0,  "CUT",   "G1 LENGTH:"),
+    [Phase_BackX]  = M800_MOVE(Plan_G0,     Phase_BackZ,  X_back, 0,      Z_last, 0,  "BACKX", "G0 BACKX: "),
+    [Phase_Band]   = M800_MOVE(Plan_G0,     Phase_Depth,  X_last, 0,      Z_last, 0,  "BAND",  "G0 BAND:  "),
+    [Phase_BackZ]  = M800_MOVE(Plan_G0,     Phase_Safe,   X_last, 0,      Z_safe, 0,  "BACKZ", "G0 BACKZ: "),
+    [Phase_Probe]  = M800_MOVE(Plan_Plunge, Phase_Safe,   X_last, 0,      Z_last, 0,  "PROBE", "G1 PROBE: "),
+    [Phase_Index]  = M800_MOVE(Plan_G0,     Phase_Index,  X_last, 0,      Z_last, 0,  "INDEX", "G0 INDEX: "),
+    [Phase_Return] = M800_MOVE(Plan_G0,     Phase_Done,   X_new_start, 0, Z_safe, 0,  "RET",   "RETURN:   ")
+};
+
+#if M800_DEBUG == 2
+
+// -----------------------------------------------------------------------------
+// DEFERRED MOVE LOG (M800_DEBUG = 2)
+// -----------------------------------------------------------------------------
+//  Single producer (m800_next_move) and single consumer (m800_log_drain),
+//  both in the foreground.
+
+typedef struct {
+    float X;
+    float Z;
+    uint16_t pass;
+    uint16_t rep;
+    uint8_t phase;                  // m800_phase_t
+} m800_log_record_t;
+
+static m800_log_record_t log_ring[M800_LOG_RING];
+static volatile uint_fast16_t log_head = 0, log_tail = 0;
+static uint32_t log_dropped = 0;
+
+static void m800_log_push(m800_phase_t phase, int pass, int rep, float X, float Z)
+{
+    uint_fast16_t next = (log_head + 1) & (M800_LOG_RING - 1);
+
+    if(next == log_tail) {
+        log_dropped++;
+        return;
+    }
+
+    log_ring[log_head].X = X;
+    log_ring[log_head].Z = Z;
+    log_ring[log_head].pass = (uint16_t)pass;
+    log_ring[log_head].rep = (uint16_t)rep;
+    log_ring[log_head].phase = (uint8_t)phase;
+    log_head = next;
+}
+
+// Send one record, or the dropped count once the backlog is written
+
+static void m800_log_drain(void)
+{
+    char dbg[128];
+
+    if(log_tail != log_head) {
+        m800_log_record_t record = log_ring[log_tail];
+        log_tail = (log_tail + 1) & (M800_LOG_RING - 1);
+        M800_LOG("M800 %s X=%.3f Z=%.3f (pass=%d rep=%d)\r\n",
+                 m800_move[record.phase].name, record.X, record.Z, record.pass, record.rep);
+    } else if(log_dropped) {
+        M800_LOG("M800 LOG: %lu moves not logged\r\n", (unsigned long)log_dropped);
+        log_dropped = 0;
+    }
+}
+
+#endif
+
+// Load depth, repetitions and stroke feed of the current level
+
+static void m800_level(m800_cycle_t *c)
+{
+    const m800_pass_t *level = m800_pass(c->pass);
+
+    c->X_target = level->X;
+    c->reps = level->reps;
+    c->plan_cut = level->feed == Feed_Cut ? &c->plan_g1 : &c->plan_air;
+}
+
+// Advance to the next stroke: next rep at the same level, else the next
+// keyway or level. The safety pass runs once for all keyways; then either
+// every keyway is cut at a level before stepping in (default), or each
+// keyway is cut to full depth in turn (by_keyway).
+// Returns false when all strokes have been generated.
+
+static bool m800_next_stroke(m800_cycle_t *c)
+{
+    if(++c->rep < c->reps)
+        return true;
+
+    if(c->pass > 0 && c->keyway + 1 < c->keyways && (!c->by_keyway || c->pass == c->passes)) {
+        c->keyway++;
+        c->rep = 0;
+        if(c->by_keyway) {
+            c->pass = 1;
+            c->X_back = c->X_new_start;
+            m800_level(c);
+        }
+        return true;
+    }
+
+    if(c->pass >= c->passes)
+        return false;
+
+    c->pass++;
+    c->rep = 0;
+    if(!c->by_keyway)
+        c->keyway = 0;
+    m800_level(c);
+
+    return true;
+}
+
+#if M800_INDEX_AXIS >= 0
+
+// Rotary index due before this phase: only ever at Z_start + R, before the
+// first move of a keyway, and back to the start position before the return.
+
+static bool m800_index_due(const m800_cycle_t *c, m800_phase_t phase, float *angle)
+{
+    if(phase == Phase_Safe || (phase == Phase_Depth && !c->at_far_end))
+        *angle = c->A_start + c->keyway * c->A_step;
+    else if(phase == Phase_Return && c->return_home)
+        *angle = c->A_start;
+    else
+        return false;
+
+    return *angle != c->A_last;
+}
+
+#endif
+
+// Generate the next move of the cycle into c->target/pl_data.
+// Returns false when the cycle is complete.
+
+static bool m800_next_move(m800_cycle_t *c, plan_line_data_t **pl_data)
+{
+    float *target = c->target;
+    m800_phase_t phase = c->phase;
+#if M800_DEBUG && M800_DEBUG != 2
+    char dbg[128];
+#endif
+
+    target[X_AXIS] = c->X_last;
+    target[Z_AXIS] = c->Z_last;
+
+#if M800_INDEX_AXIS >= 0
+    float angle;
+
+    // Index as an extra move, the phase itself follows
+    if(m800_index_due(c, phase, &angle)) {
+        target[M800_INDEX_AXIS] = angle;
+        phase = Phase_Index;
+    }
+#endif
+
+    c->move_phase = phase;
+    c->move_pass = c->pass;
+    c->move_rep = c->rep;
+    c->move_keyway = c->keyway;
+    c->move_band = c->band;
+
+    if(phase == Phase_Done || phase == Phase_Probe)
+        return false;
+
+    // Planner data, target and successor from the template, the phases
+    // below only handle their exceptions and branches
+    const m800_template_t *move = &m800_move[phase];
+
+    *pl_data = move->plan == Plan_G0 ? &c->plan_g0 : move->plan == Plan_Plunge ? &c->plan_plunge : c->plan_cut;
+    target[X_AXIS] = *(const float *)((const char *)c + move->x) + (float)move->blend_x * c->blend;
+    target[Z_AXIS] = *(const float *)((const char *)c + move->z) + (float)move->blend_z * c->blend;
+    if(phase != Phase_Index)
+        c->phase = (m800_phase_t)move->next;
+
+    switch(phase) {
+
+        case Phase_Prepos:
+            // G0 to sag-compensated X + retract Z
+            if(c->bidirectional)
+                c->phase = Phase_Depth;
+            break;
+
+        case Phase_Entry:
+            // Blended corner into the stroke, ends at Z >= Z_start
+            c->blend = 0.0f;
+            break;
+
+        case Phase_Length:
+            // Cut full Z length (of the band), X unchanged
+            target[Z_AXIS] = c->at_far_end ? c->Z_safe : c->band_end[c->band];
+            c->strokes++;
+            // Retract X: full retract to X_new_start, or only C back from the
+            // current depth (never above X_new_start, also when by_keyway
+            // starts the next keyway from pass 1 again)
+            if(c->C > 0.0f)
+                c->X_back = fmaxf(c->X_target - c->C, c->X_new_start);
+            if(!c->bidirectional) {
+                c->at_far_end = true;
+                break;
+            }
+            c->at_far_end = !c->at_far_end;
+            c->last_stroke = !m800_next_stroke(c);
+            if(c->last_stroke)
+                c->phase = c->at_far_end ? Phase_BackX : Phase_Return;
+            else
+                c->phase = Phase_Depth;
+#if M800_EVACUATE_STROKES > 0
+            // Chip evacuation: leave the bore from the far end
+            if(!c->last_stroke && c->at_far_end && (c->strokes % M800_EVACUATE_STROKES) == 0)
+                c->phase = Phase_BackX;
+#endif
+#if M800_INDEX_AXIS >= 0
+            // Next keyway: leave the bore from the far end, index at Z_start + R
+            if(!c->last_stroke && c->at_far_end && c->keyway != c->move_keyway)
+                c->phase = Phase_BackX;
+#endif
+            break;
+
+        case Phase_BackX:
+            // Retract X to safe X, Z unchanged. With several Z bands the rapids
+            // cross uncut wall between the bands: full retract, J only shortens
+            // the plunge from Z_start + R
+            if(c->bands > 1)
+                target[X_AXIS] = c->X_new_start;
+            if(c->band + 1 < c->bands)
+                c->phase = Phase_Band;
+            // Blended: angled lift-off back along the cut slot, Z travel
+            // limited to the radial clearance (never toward the next band)
+            if(M800_BLEND > 0.0f && c->phase == Phase_BackZ)
+                target[Z_AXIS] += fminf(M800_BLEND, fmaxf(c->X_last - target[X_AXIS], 0.0f));
+            break;
+
+        case Phase_Band:
+            // Next Z band: rapid along the bore at X_new_start, then plunge
+            c->band++;
+            c->move_band = c->band;
+            c->at_far_end = false;
+            target[Z_AXIS] = c->band_start[c->band];
+            break;
+
+        case Phase_BackZ:
+            // Retract Z to safe Z, X unchanged
+            c->at_far_end = false;
+            c->band = 0;
+            if(c->bidirectional) {
+                c->phase = c->last_stroke ? Phase_Return : Phase_Depth;
+                break;
+            }
+            c->phase = m800_next_stroke(c) ? Phase_Safe : Phase_Return;
+#if M800_PROBE
+            // Out of the bore before the last level: pause for m800_probe()
+            if(c->probe > 0.0f && !c->probed && !c->preview && c->phase == Phase_Safe &&
+                c->pass == c->passes && c->passes > 1)
+                c->phase = Phase_Probe;
+#endif
+            // Blended: the Z return ends in a corner to the next plunge, inside
+            // Z_start + R and only on the same keyway (index at Z_start + R)
+            if(M800_BLEND > 0.0f && c->phase == Phase_Safe && c->keyway == c->move_keyway) {
+                c->blend = fminf(M800_BLEND, fminf(c->Z_safe - c->Z_start, (c->X_target - c->X_back) * 0.5f));
+                c->blend = fmaxf(c->blend, 0.0f);
+                target[Z_AXIS] -= c->blend;
+            }
+            break;
+
+        case Phase_Return:
+            if(c->return_home) {
+                target[X_AXIS] = c->X_start;
+                target[Z_AXIS] = c->Z_start;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+#if M800_DEBUG == 2
+    if(!c->preview)
+        m800_log_push(phase, c->move_pass, c->move_rep + 1, target[X_AXIS], target[Z_AXIS]);
+#else
+    if(!c->preview)
+        M800_LOG("M800 %s X=%.3f Z=%.3f (pass=%d rep=%d)\r\n",
+                 m800_move[phase].name, target[X_AXIS], target[Z_AXIS], c->move_pass, c->move_rep + 1);
+#endif
+
+    return true;
+}
+
+// Moves whose target equals the last commanded position would only cost a
+// planner block and a zero-speed junction. Targets are built from the same
+// float values, so an exact compare is enough.
+
+static inline bool m800_moves(const m800_cycle_t *c)
+{
+    return c->target[X_AXIS] != c->X_last || c->target[Z_AXIS] != c->Z_last
+#if M800_INDEX_AXIS >= 0
+            || c->target[M800_INDEX_AXIS] != c->A_last
+#endif
+            ;
+}
+
+// The generated move has been queued (or timed)
+
+static inline void m800_moved(m800_cycle_t *c)
+{
+    c->X_last = c->target[X_AXIS];
+    c->Z_last = c->target[Z_AXIS];
+#if M800_INDEX_AXIS >= 0
+    c->A_last = c->target[M800_INDEX_AXIS];
+#endif
+}
+
+#if M800_TRACE
+
+// Move trace: one line per planner block, in the order queued.
+//
+//      M800 TRACE G0 X<x> Z<z>
+//      M800 TRACE G1 X<x> Z<z> F<feed>
+//      M800 TRACE END blocks=<n> X_final=<x> Z_cut=<z> time=<s>s
+//
+// Written directly (blocking) so a trace is never incomplete.
+
+static void m800_trace(const m800_cycle_t *c, const plan_line_data_t *pl_data)
+{
+    char msg[64];
+
+    if(c->preview)
+        return;
+
+    if(pl_data->condition.rapid_motion)
+        snprintf(msg, sizeof(msg), "M800 TRACE G0 X%.4f Z%.4f",
+                 c->target[X_AXIS], c->target[Z_AXIS]);
+    else
+        snprintf(msg, sizeof(msg), "M800 TRACE G1 X%.4f Z%.4f F%.1f",
+                 c->target[X_AXIS], c->target[Z_AXIS], pl_data->feed_rate);
+
+    hal.stream.write(msg);
+
+#if M800_INDEX_AXIS >= 0
+    if(c->keyways > 1) {
+        snprintf(msg, sizeof(msg), " %c%.4f", "XYZABCUVW"[M800_INDEX_AXIS], c->target[M800_INDEX_AXIS]);
+        hal.stream.write(msg);
+    }
+#endif
+
+    hal.stream.write("\r\n");
+}
+
+static void m800_trace_end(const m800_cycle_t *c, uint32_t blocks, float time)
+{
+    char msg[96];
+
+    snprintf(msg, sizeof(msg), "M800 TRACE END blocks=%lu X_final=%.4f Z_cut=%.4f time=%.1fs\r\n",
+             (unsigned long)blocks, pass_last.X, c->band_end[c->bands - 1], time * 60.0f);
+    hal.stream.write(msg);
+}
+
+#endif
+
+// Queue c->target unless it goes nowhere.
+// Returns false if mc_line() failed (reset or alarm).
+
+static bool m800_line(m800_cycle_t *c, plan_line_data_t *pl_data)
+{
+    if(!m800_moves(c)) {
+        c->blocks.skipped++;
+        return true;
+    }
+
+    // The planner takes the acceleration from settings when a block is
+    // queued, so the override only ever applies to the cycle's own blocks.
+    // mc_line() runs the realtime loop while the planner is full: wait for
+    // room with $122 in place so the override is never seen there. The pump
+    // only calls with room, callers in the foreground may wait here.
+    if(c->Z_accel > 0.0f) {
+        while(plan_get_block_buffer_available() < M800_LINE_BLOCKS) {
+            if(!protocol_execute_realtime())
+                return false;
+        }
+    }
+
+    float Z_accel = settings.axis[Z_AXIS].acceleration;
+
+    if(c->Z_accel > 0.0f)
+        settings.axis[Z_AXIS].acceleration = c->Z_accel;
+
+    bool ok = mc_line(c->target, pl_data);
+
+    settings.axis[Z_AXIS].acceleration = Z_accel;
+
+    if(!ok)
+        return false;
+
+#if M800_TRACE
+    m800_trace(c, pl_data);
+#endif
+
+    m800_moved(c);
+    c->blocks.queued++;
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// CYCLE TIME ESTIMATE (E1, status report)
+// -----------------------------------------------------------------------------
+//  Runs the cycle generator without motion and times every move with a
+//  trapezoidal profile: accelerate from rest, cruise at the feed (or at the
+//  axis-limited rate for G0), decelerate to rest. Feed and acceleration are
+//  limited by the slowest axis along the move direction.
+//  Stopping at every block is slightly pessimistic, but the cycle moves meet
+//  at right angles where the planner slows down to near zero anyway.
+//  ramp is the time lost to acceleration against cruising the whole move,
+//  the share M803 can win back.
+//  settings.axis[] rates are mm/min and accelerations mm/min², so times are
+//  in minutes.
+
+typedef struct {
+    float time;
+    float air_time;                 // air-cut strokes
+    float rapid_time;
+    float length;                   // total tool path (mm)
+    float ramp_time;                // time above cruise, accel-limited
+    uint32_t strokes;
+    uint32_t blocks;
+} m800_estimate_t;
+
+#if M800_INDEX_AXIS >= 0
+#define M800_MOVE_AXES 3
+#else
+#define M800_MOVE_AXES 2
+#endif
+
+static float m800_move_time(const m800_cycle_t *c, const plan_line_data_t *pl_data, float *ramp)
+{
+#if M800_INDEX_AXIS >= 0
+    static const uint_fast8_t axes[M800_MOVE_AXES] = { X_AXIS, Z_AXIS, M800_INDEX_AXIS };
+#else
+    static const uint_fast8_t axes[M800_MOVE_AXES] = { X_AXIS, Z_AXIS };
+#endif
+    float delta[M800_MOVE_AXES], length, rate = 0.0f, accel = 0.0f, time;
+
+    delta[0] = c->target[X_AXIS] - c->X_last;
+    delta[1] = c->target[Z_AXIS] - c->Z_last;
+#if M800_INDEX_AXIS >= 0
+    delta[2] = c->target[M800_INDEX_AXIS] - c->A_last;
+    length = sqrtf(delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2]);
+#else
+    length = sqrtf(delta[0] * delta[0] + delta[1] * delta[1]);
+#endif
+
+    if(length == 0.0f)
+        return 0.0f;
+
+    for(uint_fast8_t idx = 0; idx < M800_MOVE_AXES; idx++) {
+        if(delta[idx] != 0.0f) {
+            float unit = fabsf(delta[idx]) / length;
+            float axis_rate = settings.axis[axes[idx]].max_rate / unit;
+            float axis_accel = (axes[idx] == Z_AXIS && c->Z_accel > 0.0f ? c->Z_accel : settings.axis[axes[idx]].acceleration) / unit;
+            if(rate == 0.0f || axis_rate < rate)
+                rate = axis_rate;
+            if(accel == 0.0f || axis_accel < accel)
+                accel = axis_accel;
+        }
+    }
+
+    if(!pl_data->condition.rapid_motion && pl_data->feed_rate < rate)
+        rate = pl_data->feed_rate;
+
+    // Trapezoid, or triangle when the move is too short to reach the rate
+    if(length >= rate * rate / accel)
+        time = length / rate + rate / accel;
+    else
+        time = 2.0f * sqrtf(length / accel);
+
+    if(ramp)
+        *ramp = time - length / rate;
+
+    return time;
+}
+
+// Same move stream as m800_pump(), including the skipped zero-length moves.
+// Also run on a copy of the cycle state before a real cycle starts, for the
+// remaining time in the status report.
+
+static void m800_estimate(m800_cycle_t *c, m800_estimate_t *est)
+{
+    float time, ramp;
+    plan_line_data_t *pl_data;
+
+    memset(est, 0, sizeof(m800_estimate_t));
+
+    while(m800_next_move(c, &pl_data)) {
+
+        if(!m800_moves(c))
+            continue;
+
+        time = m800_move_time(c, pl_data, &ramp);
+
+#if M800_TRACE
+        m800_trace(c, pl_data);
+#endif
+
+        est->time += time;
+        est->ramp_time += ramp;
+        est->length += hypotf(c->target[X_AXIS] - c->X_last, c->target[Z_AXIS] - c->Z_last);
+        est->blocks++;
+
+        if(c->move_phase == Phase_Length) {
+            if(c->move_band == c->bands - 1)
+                est->strokes++;
+            if(m800_pass(c->move_pass)->feed == Feed_Air)
+                est->air_time += time;
+        } else if(pl_data->condition.rapid_motion)
+            est->rapid_time += time;
+
+        m800_moved(c);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// PUMP
+// -----------------------------------------------------------------------------
+
+// Generation waits for room in the planner for a whole mc_line() and in the
+// marker queue (one marker slot is kept for the asynchronous end report, one
+// more for the statistics end of cycle), so mc_line() never has to wait.
+
+static inline bool m800_pump_blocked(void)
+{
+    return plan_get_block_buffer_available() < M800_LINE_BLOCKS ||
+            marker_count >= M800_MARKER_QUEUE - (M800_STATS ? 2 : 1);
+}
+
+// Queue moves while the planner has room.
+// Called from the realtime loop and once when the cycle starts.
+
+static void m800_pump(void)
+{
+    plan_line_data_t *pl_data;
+    m800_marker_t *marker;
+    uint32_t queued;
+    float time;
+
+    if(!cycle.active || cycle.pumping)
+        return;
+
+    cycle.pumping = true;
+
+    while(!m800_pump_blocked()) {
+
+        // Reset or alarm: stop right away instead of letting every
+        // remaining move fail one at a time
+        if(sys.abort) {
+            cycle.aborted = true;
+            cycle.active = false;
+            break;
+        }
+
+#if M800_INSTRUMENT
+        uint32_t ticks = M800_TICKS(), gen_ticks;
+        uint_fast16_t blocks = plan_get_block_buffer_count();
+#endif
+
+        if(!m800_next_move(&cycle, &pl_data)) {
+            cycle.active = false;
+            break;
+        }
+
+#if M800_ADAPTIVE_FEED
+        cycle.plan_g1.feed_rate = adapt.feed;
+#endif
+
+        time = m800_move_time(&cycle, pl_data, NULL);    // before m800_line() moves X_last/Z_last
+        queued = cycle.blocks.queued;
+
+#if M800_INSTRUMENT
+        gen_ticks = M800_TICKS() - ticks;
+        ticks += gen_ticks;
+#endif
+
+        if(!m800_line(&cycle, pl_data)) {
+            cycle.aborted = true;
+            cycle.active = false;
+            break;
+        }
+
+#if M800_INSTRUMENT
+        if(cycle.blocks.queued != queued)
+            m800_instr_queued(cycle.move_phase, gen_ticks, M800_TICKS() - ticks, blocks);
+#endif
+
+#if M800_STATS
+        if(cycle.blocks.queued != queued) {
+            stats.moves++;
+            stats.blocks += plan_get_block_buffer_count();
+        }
+#endif
+
+        // Progress is recorded when the move has been executed, not queued
+        if(cycle.blocks.queued != queued && (marker = m800_marker_push(Marker_Move))) {
+            marker->phase = (uint8_t)cycle.move_phase;
+            marker->pass = (uint16_t)cycle.move_pass;
+            marker->rep = (uint16_t)cycle.move_rep;
+            marker->keyway = (uint8_t)cycle.move_keyway;
+            marker->stroke = cycle.move_phase == Phase_Length && cycle.move_band == cycle.bands - 1;
+            marker->reps = m800_pass(cycle.move_pass)->reps;
+            marker->level = (uint32_t)cycle.move_pass;
+            if(cycle.by_keyway && cycle.move_pass)      // M801 L1: keyway after keyway to full depth
+                marker->level += (uint32_t)(cycle.move_keyway * cycle.passes);
+            marker->time = time;
+            marker->key = cycle.key;
+#if M800_STATS
+            marker->time_kind = pl_data == &cycle.plan_air ? Time_Air : pl_data->condition.rapid_motion ? Time_Rapid : Time_Cut;
+#endif
+        }
+    }
+
+    cycle.pumping = false;
+}
+
+static void m800_execute_realtime(uint_fast16_t state)
+{
+    on_execute_realtime(state);
+
+    m800_pump();
+
+    if(marker_count)
+        m800_marker_poll();
+
+#if M800_CHECKPOINT
+    if(checkpoint_pending && (!cycle.active || m800_pump_blocked()))
+        m800_checkpoint_write();
+#endif
+
+#if M800_STATS
+    if(stats_pending && (!cycle.active || m800_pump_blocked()))
+        m800_stats_write();
+#endif
+
+#if M800_ADAPTIVE_FEED
+    // Sample the Z load while a cutting stroke is being executed
+    if(load_source) {
+        const m800_marker_t *move = m800_marker_current();
+        if(move && move->phase == Phase_Length && m800_pass(move->pass)->feed == Feed_Cut) {
+            float load = load_source();
+            if(load > adapt.peak)
+                adapt.peak = load;
+        }
+    }
+#endif
+
+#if M800_DEBUG == 2
+    // After the pump: the planner is as full as the cycle can make it
+    m800_log_drain();
+#endif
+}
+
+// May be called from interrupt context: only drop state here.
+// Markers still pending are discarded, so the recorded progress is the last
+// stroke known to be done before the reset.
+
+static void m800_reset(void)
+{
+    cycle.active = false;
+    cycle.aborted = true;
+
+    marker_count = 0;
+    marker_block = NULL;
+
+    if(on_reset)
+        on_reset();
+}
+
+
+#if M800_PROBE
+
+// -----------------------------------------------------------------------------
+// PROBE TRIM (M804)
+// -----------------------------------------------------------------------------
+//  The generator pauses out of the bore before the last level (finishing and
+//  spring strokes). With the planner drained the tool rapids in at X_back to
+//  the middle of the first band and probes +X at the plunge feed toward the
+//  floor of the previous level, at most M804 P past it. The floor the tool
+//  actually left (deflection) gives the trim added to the last level.
+//  No contact ends the cycle with a warning, a trim above P is not applied.
+//  Returns false on reset/alarm.
+
+static bool m800_probe(m800_cycle_t *c)
+{
+    char dbg[128];
+    plan_line_data_t pl_data;
+    gc_parser_flags_t flags = {0};
+    gc_probe_t probed;
+    float X_floor = m800_pass(c->passes - 1)->X, position[N_AXIS], trim = 0.0f;
+    float Z_probe = (c->Z_start + c->Z_cut) * 0.5f;
+
+    c->probed = true;
+    c->phase = Phase_Safe;
+
+    // In at the retract X
+    c->target[X_AXIS] = c->X_back;
+    c->target[Z_AXIS] = Z_probe;
+    if(!m800_line(c, &c->plan_g0))
+        return false;
+
+    memcpy(&pl_data, &c->plan_plunge, sizeof(plan_line_data_t));
+    pl_data.condition.target_validated = Off;   // past the cycle envelope
+    flags.probe_is_no_error = On;
+
+    // Never past the finished depth, whatever M804 P allows
+    c->target[X_AXIS] = fminf(X_floor + c->probe, pass_last.X);
+    probed = mc_probe_cycle(c->target, &pl_data, flags);
+
+    if(sys.abort || probed == GCProbe_Abort)
+        return false;
+
+    // Where the planner is now (stopped past the trigger point)
+    system_convert_array_steps_to_mpos(position, sys.position);
+    c->X_last = position[X_AXIS];
+
+    if(probed == GCProbe_Found) {
+        system_convert_array_steps_to_mpos(position, sys.probe_position);
+        trim = X_floor - position[X_AXIS];
+
+        // ALWAYS ON
+        snprintf(dbg, sizeof(dbg), "M800 PROBE: X=%.3f floor=%.3f trim=%.3f\r\n",
+                 position[X_AXIS], X_floor, trim);
+        hal.stream.write(dbg);
+
+        if(trim > c->probe) {
+            report_message("M800: probe trim above M804 P, not applied.", Message_Warning);
+            trim = 0.0f;
+        } else if(trim < 0.0f)
+            trim = 0.0f;    // deeper than commanded: nothing to add
+
+        pass_last.X += trim;
+        c->X_target += trim;
+
+#if M800_VALIDATE_ONCE
+        // The envelope was checked for the untrimmed X_final
+        position[X_AXIS] = c->X_target;
+        position[Z_AXIS] = c->band_end[c->bands - 1];
+        limits_soft_check(position, c->plan_g0.condition);
+        if(sys.abort)
+            return false;
+#endif
+    } else if(probed != GCProbe_CheckMode) {
+        report_message("M800: probe found no contact, cycle ended.", Message_Warning);
+        c->phase = Phase_Return;
+    }
+
+    // Back out along the slot to Z_start + R
+    c->target[X_AXIS] = c->X_back;
+    if(!m800_line(c, &c->plan_g0))
+        return false;
+
+    c->target[Z_AXIS] = c->Z_safe;
+
+    return m800_line(c, &c->plan_g0);
+}
+
+#endif
+
+
+#if M800_STATUS_REPORT
+
+// -----------------------------------------------------------------------------
+// STATUS REPORT
+// -----------------------------------------------------------------------------
+//  Appends |M800:<pass>/<passes>,<rep>/<reps>,<phase>,<remaining s> for the
+//  move being executed, ie. the oldest cycle move still in the planner,
+//  followed by ,<keyway>/<keyways> when indexing (M801).
+
+static void m800_realtime_report(stream_write_ptr stream_write, report_tracking_flags_t report)
+{
+    if(on_realtime_report)
+        on_realtime_report(stream_write, report);
+
+    const m800_marker_t *move;
+
+    if((move = m800_marker_current())) {
+
+        char buf[48];
+
+        snprintf(buf, sizeof(buf), "|M800:%u/%d,%u/%u,%s,%.0f",
+                 (unsigned)move->pass, status.passes, (unsigned)move->rep + 1, (unsigned)move->reps,
+                 m800_move[move->phase].code, status.remaining > 0.0f ? status.remaining * 60.0f : 0.0f);
+        stream_write(buf);
+
+        if(status.keyways > 1) {
+            snprintf(buf, sizeof(buf), ",%u/%d", (unsigned)move->keyway + 1, status.keyways);
+            stream_write(buf);
+        }
+    }
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// HELPER: CYCLE KEY (RESUME)
+// -----------------------------------------------------------------------------
+//  FNV-1a hash of the words and start position that define the pass
+//  schedule, so K-1 only resumes the cycle the progress belongs to.
+
+static uint32_t m800_hash(uint32_t hash, const void *data, size_t size)
+{
+    const uint8_t *byte = (const uint8_t *)data;
+
+    while(size--)
+        hash = (hash ^ *byte++) * 16777619UL;
+
+    return hash;
+}
+
+static uint32_t m800_cycle_key(const m800_job_t *job, const float start_pos[N_AXIS])
+{
+    uint32_t hash = 2166136261UL;
+
+    hash = m800_hash(hash, &job->d, sizeof(float));
+    hash = m800_hash(hash, &job->q, sizeof(float));
+    hash = m800_hash(hash, &job->s, sizeof(float));
+    hash = m800_hash(hash, &job->p, sizeof(float));
+    hash = m800_hash(hash, &job->r, sizeof(float));
+    hash = m800_hash(hash, &job->l, sizeof(int));
+    hash = m800_hash(hash, &job->j, sizeof(float));
+    hash = m800_hash(hash, &start_pos[X_AXIS], sizeof(float));
+    hash = m800_hash(hash, &start_pos[Z_AXIS], sizeof(float));
+#if M800_INDEX_AXIS >= 0
+    hash = m800_hash(hash, &start_pos[M800_INDEX_AXIS], sizeof(float));
+    hash = m800_hash(hash, &index_setup.count, sizeof(index_setup.count));
+    hash = m800_hash(hash, &index_setup.step, sizeof(float));
+    hash = m800_hash(hash, &index_setup.by_keyway, sizeof(bool));
+#endif
+#if M800_Z_BANDS
+    hash = m800_hash(hash, &band_setup, sizeof(band_setup));
+#endif
+    hash = m800_hash(hash, &tool_setup, sizeof(tool_setup));
+
+    return hash;
+}
+
+
+// -----------------------------------------------------------------------------
+// HELPER: CANCEL A CYCLE AFTER CYCLE START
+// -----------------------------------------------------------------------------
+//  Evaluate mode has no CYCLE START to close, the warning is enough.
+
+static void m800_cancel(const char *message, bool evaluate)
+{
+    report_message(message, Message_Warning);
+
+    if(evaluate)
+        return;
+
+    // ALWAYS ON
+#if M800_ASYNC_END
+    m800_report_end(cycle_id);
+#else
+    hal.stream.write("M800 CYCLE END\r\n");
+#endif
+}
+
+
+#if M800_INDEX_AXIS >= 0
+
+// -----------------------------------------------------------------------------
+// MULTI-KEYWAY INDEXING (M801)
+// -----------------------------------------------------------------------------
+//  M801 P<count> [Q<angle step>] [L<order>] sets up the following M800
+//  blocks: Q defaults to 360 / P (equally spaced), L0 = level by level
+//  (default), L1 = each keyway to full depth. M801 P1 turns indexing off.
+
+static status_code_t m800_index_validate(parser_block_t *gc_block)
+{
+    if(!gc_block->words.p || gc_block->values.p < 1.0f || gc_block->values.p > 255.0f ||
+        gc_block->values.p != floorf(gc_block->values.p))
+        return Status_InvalidStatement;
+
+    if(gc_block->words.q && gc_block->values.q == 0.0f)
+        return Status_InvalidStatement;
+
+    if(gc_block->words.l && gc_block->values.l > 1)
+        return Status_InvalidStatement;
+
+    if(!gc_block->words.q)
+        gc_block->values.q = 360.0f / gc_block->values.p;
+    if(!gc_block->words.l)
+        gc_block->values.l = 0;
+
+    gc_block->words.p = Off;
+    gc_block->words.q = Off;
+    gc_block->words.l = Off;
+
+    return Status_OK;
+}
+
+static void m800_index_execute(parser_block_t *gc_block)
+{
+#if M800_DEBUG
+    char dbg[128];
+#endif
+
+    index_setup.count = (uint16_t)gc_block->values.p;
+    index_setup.step = gc_block->values.q;
+    index_setup.by_keyway = gc_block->values.l == 1;
+
+    M800_LOG("M801 KEYWAYS=%d STEP=%.3f %s\r\n",
+             index_setup.count, index_setup.step, index_setup.by_keyway ? "BY KEYWAY" : "BY LEVEL");
+}
+
+#endif
+
+
+#if M800_Z_BANDS
+
+// -----------------------------------------------------------------------------
+// Z BANDS (M802)
+// -----------------------------------------------------------------------------
+//  M802 P<Z offset> Q<length> appends a band to the following M800 blocks,
+//  M802 without words clears the list. The offset is measured from Z_start
+//  into the bore (−Z), like Q. The bands must follow the M800 Q band and
+//  each other without overlapping, this is checked by M800 since Q is only
+//  known there.
+
+static status_code_t m800_bands_validate(parser_block_t *gc_block)
+{
+    // Bare M802: clear
+    if(!gc_block->words.p && !gc_block->words.q) {
+        gc_block->values.q = 0.0f;
+        return Status_OK;
+    }
+
+    if(!gc_block->words.p || !gc_block->words.q ||
+        gc_block->values.p <= 0.0f || gc_block->values.q <= 0.0f)
+        return Status_InvalidStatement;
+
+    if(band_setup.count >= M800_MAX_BANDS - 1)
+        return Status_InvalidStatement;
+
+    gc_block->words.p = Off;
+    gc_block->words.q = Off;
+
+    return Status_OK;
+}
+
+static void m800_bands_execute(parser_block_t *gc_block)
+{
+#if M800_DEBUG
+    char dbg[128];
+#endif
+
+    if(gc_block->values.q <= 0.0f) {
+        band_setup.count = 0;
+        M800_LOG("M802 BANDS CLEARED\r\n");
+        return;
+    }
+
+    band_setup.offset[band_setup.count] = gc_block->values.p;
+    band_setup.length[band_setup.count] = gc_block->values.q;
+    band_setup.count++;
+
+    M800_LOG("M802 BAND %d: OFFSET=%.3f LENGTH=%.3f\r\n",
+             band_setup.count, gc_block->values.p, gc_block->values.q);
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// Z ACCELERATION OVERRIDE (M803)
+// -----------------------------------------------------------------------------
+//  M803 P<mm/s²> sets the Z acceleration of the following M800 cycles, in the
+//  units of $122, M803 without words goes back to the machine setting.
+
+static status_code_t m800_accel_validate(parser_block_t *gc_block)
+{
+    if(!gc_block->words.p) {
+        gc_block->values.p = 0.0f;
+        return Status_OK;
+    }
+
+    if(gc_block->values.p <= 0.0f)
+        return Status_InvalidStatement;
+
+    gc_block->words.p = Off;
+
+    return Status_OK;
+}
+
+static void m800_accel_execute(parser_block_t *gc_block)
+{
+#if M800_DEBUG
+    char dbg[128];
+#endif
+
+    z_accel_setup = gc_block->values.p * 60.0f * 60.0f;
+
+    M800_LOG("M803 Z ACCEL=%.1f mm/s^2 (machine %.1f)\r\n",
+             gc_block->values.p, settings.axis[Z_AXIS].acceleration / (60.0f * 60.0f));
+}
+
+
+// -----------------------------------------------------------------------------
+// TOOL SETUP (M807)
+// -----------------------------------------------------------------------------
+//  M807 [P<spring passes>] [Q<1 = double-edged>] sets the tool of the
+//  following M800 cycles, words not given and M807 without words go back to
+//  the build defaults.
+
+static status_code_t m800_tool_validate(parser_block_t *gc_block)
+{
+    if(gc_block->words.p && (gc_block->values.p < 0.0f || gc_block->values.p > 255.0f ||
+        gc_block->values.p != floorf(gc_block->values.p)))
+        return Status_InvalidStatement;
+
+    if(gc_block->words.q && gc_block->values.q != 0.0f && gc_block->values.q != 1.0f)
+        return Status_InvalidStatement;
+
+    if(!gc_block->words.p)
+        gc_block->values.p = (float)M800_SPRING_PASSES;
+    if(!gc_block->words.q)
+        gc_block->values.q = M800_BIDIRECTIONAL ? 1.0f : 0.0f;
+
+    gc_block->words.p = Off;
+    gc_block->words.q = Off;
+
+    return Status_OK;
+}
+
+static void m800_tool_execute(parser_block_t *gc_block)
+{
+#if M800_DEBUG
+    char dbg[128];
+#endif
+
+    tool_setup.spring = (uint16_t)gc_block->values.p;
+    tool_setup.bidirectional = gc_block->values.q == 1.0f;
+
+    M800_LOG("M807 SPRING=%d %s\r\n", tool_setup.spring,
+             tool_setup.bidirectional ? "BIDIRECTIONAL" : "UNIDIRECTIONAL");
+}
+
+
+#if M800_PROBE
+
+// -----------------------------------------------------------------------------
+// PROBE TRIM SETUP (M804)
+// -----------------------------------------------------------------------------
+//  M804 P<max trim> turns probing on for the following M800 cycles, P is the
+//  largest depth correction accepted (and the probe overtravel). M804 without
+//  words turns it off.
+
+static status_code_t m800_probe_validate(parser_block_t *gc_block)
+{
+    if(!gc_block->words.p) {
+        gc_block->values.p = 0.0f;
+        return Status_OK;
+    }
+
+    if(gc_block->values.p <= 0.0f)
+        return Status_InvalidStatement;
+
+    gc_block->words.p = Off;
+
+    return Status_OK;
+}
+
+static void m800_probe_execute(parser_block_t *gc_block)
+{
+#if M800_DEBUG
+    char dbg[128];
+#endif
+
+    probe_setup = gc_block->values.p;
+
+    M800_LOG("M804 PROBE %s MAX TRIM=%.3f\r\n", probe_setup > 0.0f ? "ON" : "OFF", probe_setup);
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// CYCLE WORDS
+// -----------------------------------------------------------------------------
+//  Rules for the M800 words, shared by M800/M81n and the preset settings.
+//  Missing required words read 0 and fail here.
+
+static status_code_t m800_check_words(const parser_block_t *gc_block)
+{
+    if(gc_block->values.d <= 0.0f) return Status_InvalidStatement;
+    if(gc_block->values.q <= 0.0f) return Status_InvalidStatement;
+    if(gc_block->values.s <= 0.0f) return Status_InvalidStatement;
+    if(gc_block->values.p <= 0.0f) return Status_InvalidStatement;
+    if(gc_block->values.r <= 0.0f) return Status_InvalidStatement;
+
+    if(gc_block->values.p > gc_block->values.d)
+        return Status_InvalidStatement;
+
+    if(gc_block->words.l && gc_block->values.l < 1)
+        return Status_InvalidStatement;
+
+    if(gc_block->words.h)
+        if(gc_block->values.h != 0.0f && gc_block->values.h != 1.0f)
+            return Status_InvalidStatement;
+
+    if(gc_block->words.j && gc_block->values.ijk[Y_AXIS] <= 0.0f)
+        return Status_InvalidStatement;
+
+    if(gc_block->words.i && gc_block->values.ijk[X_AXIS] <= 0.0f)
+        return Status_InvalidStatement;
+
+    if(gc_block->words.k) {
+        float k = gc_block->values.ijk[Z_AXIS];
+        if(k != floorf(k) || (k != -1.0f && k < 1.0f))
+            return Status_InvalidStatement;
+    }
+
+    if(gc_block->words.e && gc_block->values.e != 1.0f)
         return Status_InvalidStatement;
 
-    gc_block->words.d = Off;
-    gc_block->words.q = Off;
-    gc_block->words.s = Off;
-    gc_block->words.p = Off;
-    gc_block->words.r = Off;
-    gc_block->words.l = Off;
-    gc_block->words.h = Off;
+    return Status_OK;
+}
+
+// Resolve defaults for the optional words and claim the words of a checked
+// block, execute only sees the values.
+
+static void m800_claim_words(parser_block_t *gc_block)
+{
+    if(!gc_block->words.l)
+        gc_block->values.l = 1;
+    if(!gc_block->words.h)
+        gc_block->values.h = 1;
+    if(!gc_block->words.j)
+        gc_block->values.ijk[Y_AXIS] = 0.0f;    // full retract
+    if(!gc_block->words.i)
+        gc_block->values.ijk[X_AXIS] = 0.0f;    // plunge at F
+    if(!gc_block->words.k)
+        gc_block->values.ijk[Z_AXIS] = 0.0f;    // no resume
+    if(!gc_block->words.e)
+        gc_block->values.e = 0.0f;              // run the cycle
+
+    gc_block->words.d = Off;
+    gc_block->words.q = Off;
+    gc_block->words.s = Off;
+    gc_block->words.p = Off;
+    gc_block->words.r = Off;
+    gc_block->words.l = Off;
+    gc_block->words.h = Off;
+    gc_block->words.j = Off;
+    gc_block->words.i = Off;
+    gc_block->words.k = Off;
+    gc_block->words.e = Off;
+}
+
+// Cycle words of a claimed block, with the current feed
+
+static void m800_job_init(m800_job_t *job, const parser_block_t *gc_block)
+{
+    job->d = gc_block->values.d;
+    job->q = gc_block->values.q;
+    job->s = gc_block->values.s;
+    job->p = gc_block->values.p;
+    job->r = gc_block->values.r;
+    job->j = gc_block->values.ijk[Y_AXIS];
+    job->i = gc_block->values.ijk[X_AXIS];
+    job->feed = gc_state.feed_rate;
+    job->l = (int)gc_block->values.l;
+    job->h = gc_block->values.h == 1.0f;
+    job->preset = 0;
+#if M800_PRESETS
+    if(M800_IS_PRESET(gc_block->user_mcode))
+        job->preset = (uint8_t)(gc_block->user_mcode - M800_Preset + 1);
+#endif
+}
+
+
+#if M800_PRESETS
+
+// -----------------------------------------------------------------------------
+// CYCLE PRESETS (M810..M817, $450..$457)
+// -----------------------------------------------------------------------------
+//  A preset holds the M800 words D Q S P R L H J I as a plugin setting, eg.
+//  $450=D2 Q10 S8 P0.5 R2 L1 H1 J0.2. The text is parsed and checked once,
+//  when the setting is written, and stored in NVS in binary form: M81n only
+//  copies the values into the words its block does not set. Geometry stays
+//  per call: the sag and the pass table depend on the start X.
+//  An empty value clears the preset.
+
+typedef struct {
+    float d, q, s, p, r;
+    float j;                        // clearance, 0 = full retract
+    float i;                        // plunge feed, 0 = F
+    uint16_t l;
+    uint8_t h;
+    bool valid;
+} m800_preset_t;
+
+typedef struct {
+    m800_preset_t preset[M800_PRESETS];
+} m800_settings_t;
+
+static nvs_address_t nvs_address;
+static m800_settings_t m800_settings;
+static char preset_name[M800_PRESETS][20];   // "M800 preset M81n"
+static setting_detail_t preset_setting[M800_PRESETS];
+
+static status_code_t m800_preset_set(setting_id_t id, char *svalue)
+{
+    m800_preset_t *preset = &m800_settings.preset[id - Setting_UserDefined_0];
+    parser_block_t block;
+    uint_fast8_t idx = 0;
+    status_code_t status;
+
+    memset(&block, 0, sizeof(parser_block_t));
+
+    while(svalue[idx]) {
+
+        char letter = CAPS(svalue[idx]);
+        float value;
+
+        if(letter == ' ') {
+            idx++;
+            continue;
+        }
+
+        idx++;
+        if(!read_float(svalue, &idx, &value))
+            return Status_BadNumberFormat;
+
+        if(value < 0.0f)
+            return Status_InvalidStatement;
+
+        switch(letter) {
+            case 'D': block.words.d = On; block.values.d = value; break;
+            case 'Q': block.words.q = On; block.values.q = value; break;
+            case 'S': block.words.s = On; block.values.s = value; break;
+            case 'P': block.words.p = On; block.values.p = value; break;
+            case 'R': block.words.r = On; block.values.r = value; break;
+            case 'L':
+                if(value < 1.0f || value > 255.0f)      // values.l is 8 bits
+                    return Status_InvalidStatement;
+                block.words.l = On;
+                block.values.l = (uint8_t)value;
+                break;
+            case 'H':
+                if(value > 255.0f)
+                    return Status_InvalidStatement;
+                block.words.h = On;
+                block.values.h = (uint8_t)value;
+                break;
+            case 'J': block.words.j = On; block.values.ijk[Y_AXIS] = value; break;
+            case 'I': block.words.i = On; block.values.ijk[X_AXIS] = value; break;
+            default:
+                return Status_InvalidStatement;
+        }
+    }
+
+    if(block.words.mask == 0) {
+        preset->valid = false;
+        return Status_OK;
+    }
+
+    if((status = m800_check_words(&block)) != Status_OK)
+        return status;
+
+    preset->d = block.values.d;
+    preset->q = block.values.q;
+    preset->s = block.values.s;
+    preset->p = block.values.p;
+    preset->r = block.values.r;
+    preset->l = block.words.l ? (uint16_t)block.values.l : 1;
+    preset->h = block.words.h ? (uint8_t)block.values.h : 1;
+    preset->j = block.words.j ? block.values.ijk[Y_AXIS] : 0.0f;
+    preset->i = block.words.i ? block.values.ijk[X_AXIS] : 0.0f;
+    preset->valid = true;
+
+    return Status_OK;
+}
+
+static char *m800_preset_get(setting_id_t id)
+{
+    static char text[80];
+
+    const m800_preset_t *preset = &m800_settings.preset[id - Setting_UserDefined_0];
+    int len;
+
+    *text = '\0';
+
+    if(preset->valid) {
+        len = snprintf(text, sizeof(text), "D%.3f Q%.3f S%.3f P%.3f R%.3f L%u H%u",
+                       preset->d, preset->q, preset->s, preset->p, preset->r, preset->l, preset->h);
+        if(preset->j > 0.0f)
+            len += snprintf(text + len, sizeof(text) - len, " J%.3f", preset->j);
+        if(preset->i > 0.0f)
+            snprintf(text + len, sizeof(text) - len, " I%.1f", preset->i);
+    }
+
+    return text;
+}
+
+// Fill the words of an M81n block from its preset.
+// Returns false if the preset is empty.
+
+static bool m800_preset_merge(parser_block_t *gc_block)
+{
+    const m800_preset_t *preset = &m800_settings.preset[gc_block->user_mcode - M800_Preset];
+
+    if(!preset->valid)
+        return false;
+
+    if(!gc_block->words.d) {
+        gc_block->words.d = On;
+        gc_block->values.d = preset->d;
+    }
+    if(!gc_block->words.q) {
+        gc_block->words.q = On;
+        gc_block->values.q = preset->q;
+    }
+    if(!gc_block->words.s) {
+        gc_block->words.s = On;
+        gc_block->values.s = preset->s;
+    }
+    if(!gc_block->words.p) {
+        gc_block->words.p = On;
+        gc_block->values.p = preset->p;
+    }
+    if(!gc_block->words.r) {
+        gc_block->words.r = On;
+        gc_block->values.r = preset->r;
+    }
+    if(!gc_block->words.l) {
+        gc_block->words.l = On;
+        gc_block->values.l = preset->l;
+    }
+    if(!gc_block->words.h) {
+        gc_block->words.h = On;
+        gc_block->values.h = preset->h;
+    }
+    if(!gc_block->words.j && preset->j > 0.0f) {
+        gc_block->words.j = On;
+        gc_block->values.ijk[Y_AXIS] = preset->j;
+    }
+    if(!gc_block->words.i && preset->i > 0.0f) {
+        gc_block->words.i = On;
+        gc_block->values.ijk[X_AXIS] = preset->i;
+    }
+
+    return true;
+}
+
+static const setting_group_detail_t m800_groups[] = {
+    { Group_Root, Group_UserSettings, "Keyway cycle (M800)" }
+};
+
+static void m800_settings_save(void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&m800_settings, sizeof(m800_settings_t), true);
+}
+
+static void m800_settings_restore(void)
+{
+    memset(&m800_settings, 0, sizeof(m800_settings_t));
+
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&m800_settings, sizeof(m800_settings_t), true);
+}
+
+static void m800_settings_load(void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&m800_settings, nvs_address, sizeof(m800_settings_t), true) != NVS_TransferResult_OK)
+        m800_settings_restore();
+}
+
+static setting_details_t setting_details = {
+    .groups = m800_groups,
+    .n_groups = sizeof(m800_groups) / sizeof(setting_group_detail_t),
+    .settings = preset_setting,
+    .n_settings = M800_PRESETS,
+    .save = m800_settings_save,
+    .load = m800_settings_load,
+    .restore = m800_settings_restore
+};
+
+static void m800_settings_init(void)
+{
+    if(!(nvs_address = nvs_alloc(sizeof(m800_settings_t))))
+        return;
+
+    for(uint_fast8_t n = 0; n < M800_PRESETS; n++) {
+        snprintf(preset_name[n], sizeof(preset_name[n]), "M800 preset M81%u", (unsigned)n);
+        preset_setting[n] = (setting_detail_t){
+            .id = (setting_id_t)(Setting_UserDefined_0 + n),
+            .group = Group_UserSettings,
+            .name = preset_name[n],
+            .datatype = Format_String,
+            .format = "x(64)",
+            .max_value = "64",
+            .type = Setting_NonCoreFn,
+            .value = m800_preset_set,
+            .get_value = m800_preset_get
+        };
+    }
+
+    settings_register(&setting_details);
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// CYCLE
+// -----------------------------------------------------------------------------
+//  One cycle from its words and start position. The caller reports CYCLE
+//  START before and, if the cycle was queued, CYCLE END after it (see
+//  m800_cycle_end()), so a batch can run several cycles between them.
+
+static void m800_cycle_start(void)
+{
+    // ALWAYS ON
+#if M800_ASYNC_END
+    char msg[40];
+
+    snprintf(msg, sizeof(msg), "M800 CYCLE START ID=%lu\r\n", (unsigned long)++cycle_id);
+    hal.stream.write(msg);
+#else
+    hal.stream.write("M800 CYCLE START\r\n");
+#endif
+}
+
+static void m800_cycle_end(void)
+{
+#if M800_ASYNC_END
+    // ALWAYS ON, reported from the realtime loop when the final block is done
+    m800_end_enqueue(cycle_id);
+#else
+    protocol_buffer_synchronize();
+
+    // ALWAYS ON
+    hal.stream.write("M800 CYCLE END\r\n");
+
+  #if M800_INSTRUMENT
+    m800_instr_report();
+  #endif
+#endif
+}
+
+// Returns true if the cycle has been queued. False if it was evaluated (E1),
+// cancelled (reported) or aborted.
+
+static bool m800_cycle(const m800_job_t *job, const float start_pos[N_AXIS], int K, bool evaluate)
+{
+    char dbg[128];
+
+    // -------------------------------------------------------------------------
+    // STARTING POSITIONS (ALL AXES)
+    // -------------------------------------------------------------------------
+    float X_start = start_pos[X_AXIS];
+    float Z_start = start_pos[Z_AXIS];
+
+    // -------------------------------------------------------------------------
+    // PARAMETERS
+    // -------------------------------------------------------------------------
+    float D = job->d;
+    float Q = -job->q;                       // Negative Z direction
+    float W =  job->s;
+    float P =  job->p;
+    float R =  job->r;
+    int   Lreps = job->l;
+    bool return_home = job->h;
+    float C = job->j;
+    float plunge_feed = job->i > 0.0f ? job->i : job->feed;
+    uint32_t key = m800_cycle_key(job, start_pos);
+
+    // DEBUG
+    M800_LOG("M800 GEOMETRY: X0=%.3f Z0=%.3f Q=%.3f W=%.3f Feed=%.3f\r\n",
+             X_start, Z_start, Q, W, job->feed);
+
+    // -------------------------------------------------------------------------
+    // SAG COMPENSATION
+    // -------------------------------------------------------------------------
+    float Rbore = X_start;
+    float Cslot = W;
+    float halfC = Cslot * 0.5f;
+
+    if(halfC > Rbore) {
+        m800_cancel("M800: Slot width exceeds bore diameter.", evaluate);
+        return false;
+    }
+
+    float d_center = sqrtf((Rbore * Rbore) - (halfC * halfC));
+    float sag = Rbore - d_center;
+
+    float X_new_start = X_start - sag;
+    float Dcorr = D + sag;
+    float X_final = X_new_start + Dcorr;
+
+    m800_depths_t depths;
+    m800_depths_init(&depths, Rbore, halfC, X_new_start, X_final, P);
+
+    m800_pass_table_init(&depths, Lreps, tool_setup.spring);
+
+    M800_LOG("M800 SAG: R=%.3f C=%.3f sag=%.3f X_new_start=%.3f Dcorr=%.3f Xfinal=%.3f\r\n",
+             Rbore, Cslot, sag, X_new_start, Dcorr, X_final);
+
+    M800_LOG("M800 AXIS MASK: XZ USED | ALL OTHER AXES PRESERVED (Y, A, B, C, etc.)\r\n");
+
+#if M800_CHECKPOINT
+    if(!evaluate)
+        m800_checkpoint_warn();
+#endif
+
+    // -------------------------------------------------------------------------
+    // CYCLE STATE
+    // -------------------------------------------------------------------------
+    m800_cycle_t *c = &cycle;
+
+    memset(c, 0, sizeof(m800_cycle_t));
+
+    c->X_start = X_start;
+    c->Z_start = Z_start;
+    c->X_new_start = X_new_start;
+    c->Z_cut = Z_start + Q;
+    c->Z_safe = Z_start + R;
+    c->C = C;
+    c->passes = depths.passes;
+    c->keyways = 1;
+    c->return_home = return_home;
+    c->key = key;
+    c->X_back = X_new_start;
+    c->Z_accel = z_accel_setup;
+    c->bidirectional = tool_setup.bidirectional;
+#if M800_PROBE
+    c->probe = evaluate ? 0.0f : probe_setup;
+#endif
+#if M800_INDEX_AXIS >= 0
+    c->keyways = index_setup.count;
+    c->by_keyway = index_setup.by_keyway;
+    c->A_start = c->A_last = start_pos[M800_INDEX_AXIS];
+    c->A_step = index_setup.step;
+#endif
+
+    // Z bands: band 0 is the M800 Q band from Z_start + R
+    c->bands = 1;
+    c->band_start[0] = c->Z_safe;
+    c->band_end[0] = c->Z_cut;
+#if M800_Z_BANDS
+    for(int i = 0; i < band_setup.count; i++) {
+
+        float start = Z_start - band_setup.offset[i];
+
+        if(start >= c->band_end[c->bands - 1]) {
+            m800_cancel("M800: Z bands overlap or out of order.", evaluate);
+            return false;
+        }
+
+        c->band_start[c->bands] = start;
+        c->band_end[c->bands] = start - band_setup.length[i];
+        c->bands++;
+    }
+
+    if(c->bands > 1)
+        M800_LOG("M800 Z BANDS: %d, LAST END Z=%.3f\r\n", c->bands, c->band_end[c->bands - 1]);
+#endif
+
+    // Bands and the probe pause leave the bore after every stroke
+    if(c->bidirectional && (c->bands > 1
+#if M800_PROBE
+        || c->probe > 0.0f
+#endif
+        )) {
+        m800_cancel("M800: Z bands and probe trim need a single-edged tool (M807 Q0).", evaluate);
+        return false;
+    }
+
+    // -------------------------------------------------------------------------
+    // PLAN DATA INITIALIZATION
+    // -------------------------------------------------------------------------
+    plan_data_init(&c->plan_g0);
+    plan_data_init(&c->plan_g1);
+
+    c->plan_g0.condition.rapid_motion = On;
+    c->plan_g0.spindle = *gc_state.spindle;
+
+    c->plan_g1.condition.rapid_motion = Off;
+    c->plan_g1.feed_rate = job->feed;
+    c->plan_g1.spindle = *gc_state.spindle;
+
+    // Air-cut strokes (no material section at that depth, eg. the safety
+    // pass) run at a percentage of the Z max rate, never slower than F.
+    memcpy(&c->plan_air, &c->plan_g1, sizeof(plan_line_data_t));
+    if(M800_AIR_FEED_PERCENT > 0) {
+        float air_feed = settings.axis[Z_AXIS].max_rate * (float)M800_AIR_FEED_PERCENT / 100.0f;
+        if(air_feed > c->plan_air.feed_rate)
+            c->plan_air.feed_rate = air_feed;
+    }
+
+    // X plunges at their own (usually gentler) feed
+    memcpy(&c->plan_plunge, &c->plan_g1, sizeof(plan_line_data_t));
+    c->plan_plunge.feed_rate = plunge_feed;
+
+    M800_LOG("M800 FEED: stroke=%.1f plunge=%.1f air=%.1f\r\n",
+             c->plan_g1.feed_rate, c->plan_plunge.feed_rate, c->plan_air.feed_rate);
+
+    M800_LOG("M800 PASSES=%d L=%d SPRING=%d C=%.3f%s\r\n",
+             depths.passes, Lreps, tool_setup.spring, C,
+             c->bidirectional ? " BIDIRECTIONAL" : "");
+
+#if M800_INDEX_AXIS >= 0
+    if(c->keyways > 1)
+        M800_LOG("M800 KEYWAYS=%d STEP=%.3f %s\r\n",
+                 c->keyways, c->A_step, c->by_keyway ? "BY KEYWAY" : "BY LEVEL");
+#endif
+
+    // -------------------------------------------------------------------------
+    // TRACK LAST COMMANDED POSITION (CRITICAL FOR COORDINATE COHERENCE)
+    // -------------------------------------------------------------------------
+    m800_copy_pos(c->target, start_pos);
+    c->X_last = X_start;
+    c->Z_last = Z_start;
+
+    // -------------------------------------------------------------------------
+    // RESUME (K WORD)
+    // -------------------------------------------------------------------------
+    int start_pass = 0, start_rep = 0, start_keyway = 0;
+
+    if(K == -1) {
+#if M800_CHECKPOINT
+        // Nothing recorded since power-up: last checkpoint
+        if(!progress.valid)
+            m800_checkpoint_load();
+#endif
+        if(progress.valid && progress.key == key && progress.pass >= 0) {
+            // Next stroke after the last one physically cut, in cycle order
+            c->pass = progress.pass;
+            m800_level(c);
+            c->rep = progress.rep;
+            c->keyway = progress.keyway;
+            if(m800_next_stroke(c)) {
+                start_pass = c->pass;
+                start_rep = c->rep;
+                start_keyway = c->keyway;
+            } else
+                report_message("M800: Previous cycle completed, running full cycle.", Message_Info);
+        } else
+            report_message("M800: Nothing to resume, running full cycle.", Message_Info);
+    } else if(K > 0) {
+        if(K > depths.passes) {
+            m800_cancel("M800: K exceeds the number of passes.", evaluate);
+            return false;
+        }
+        start_pass = K;
+    }
+
+    // Evaluate mode leaves the recorded progress alone
+    if(!evaluate) {
+        if(!(progress.valid && progress.key == key && (start_pass || start_rep || start_keyway)))
+            progress.pass = -1;
+        progress.key = key;
+        progress.valid = true;
+    }
+
+    M800_LOG("M800 START AT: pass=%d rep=%d keyway=%d\r\n", start_pass, start_rep + 1, start_keyway + 1);
+
+    c->phase = Phase_Prepos;
+    c->pass = start_pass;
+    m800_level(c);
+    c->rep = start_rep;
+    c->keyway = start_keyway;
+
+    // Resuming with a clearance: first plunge from just above the depth
+    // already cut, as if the previous stroke had just retracted
+    if(C > 0.0f && (start_pass > 1 || start_rep > 0)) {
+        float X_done = m800_pass(start_rep > 0 ? start_pass : start_pass - 1)->X;
+        if(X_done - C > X_new_start)
+            c->X_back = X_done - C;
+    }
+
+    // -------------------------------------------------------------------------
+    // EVALUATE (E1): same generator, no motion
+    // -------------------------------------------------------------------------
+    if(evaluate) {
+        m800_estimate_t est;
+#if M800_INSTRUMENT
+        uint32_t ticks = M800_TICKS();
+#endif
+
+        m800_estimate(c, &est);
+
+#if M800_INSTRUMENT
+        ticks = M800_TICKS() - ticks;
+#endif
+
+        // ALWAYS ON
+        snprintf(dbg, sizeof(dbg), "M800 ESTIMATE: time=%.1fs strokes=%lu blocks=%lu air=%.1fs rapid=%.1fs length=%.1fmm ramp=%.1fs\r\n",
+                 est.time * 60.0f, (unsigned long)est.strokes, (unsigned long)est.blocks,
+                 est.air_time * 60.0f, est.rapid_time * 60.0f, est.length, est.ramp_time * 60.0f);
+        hal.stream.write(dbg);
+
+#if M800_TRACE
+        m800_trace_end(c, est.blocks, est.time);
+#endif
+
+#if M800_INSTRUMENT
+        // Generator throughput: the estimate runs the same code without mc_line()
+        snprintf(dbg, sizeof(dbg), "M800 STATS: estimate moves=%lu gen=%lums\r\n",
+                 (unsigned long)est.blocks, (unsigned long)(ticks / M800_TICKS_PER_MS));
+        hal.stream.write(dbg);
+#endif
+        return false;
+    }
+
+    // -------------------------------------------------------------------------
+    // STATUS: estimate the cycle on a copy of the generator state
+    // -------------------------------------------------------------------------
+    {
+        m800_cycle_t preview;
+        m800_estimate_t est;
+
+        memcpy(&preview, c, sizeof(m800_cycle_t));
+        preview.preview = true;
+        m800_estimate(&preview, &est);
+
+        // Moves of a previous (asynchronous) cycle still in the planner
+        status.remaining = est.time;
+        for(uint_fast8_t idx = 0; idx < marker_count; idx++) {
+            if(!markers[idx].consumed)
+                status.remaining += markers[idx].time;
+        }
+        status.passes = c->passes;
+        status.keyways = c->keyways;
+#if M800_TRACE
+        status.total = est.time;
+#endif
+    }
+
+#if M800_VALIDATE_ONCE
+    // -------------------------------------------------------------------------
+    // SOFT LIMITS: once for the cycle instead of once per move
+    // -------------------------------------------------------------------------
+    //  Soft limits are per axis. Every cycle move stays within X_new_start ..
+    //  X_final and Z end of the last band .. Z_start + R (and the keyway
+    //  angles), and each of these extremes is reached by a move, so checking
+    //  the two opposite corners is exact. mc_line() then skips its own check.
+    {
+        float corner[N_AXIS];
+
+        m800_copy_pos(corner, c->target);
+        corner[X_AXIS] = c->X_new_start;
+        corner[Z_AXIS] = c->Z_safe;
+  #if M800_INDEX_AXIS >= 0
+        corner[M800_INDEX_AXIS] = c->A_start;
+  #endif
+        limits_soft_check(corner, c->plan_g0.condition);
+
+        corner[X_AXIS] = pass_last.X;
+        corner[Z_AXIS] = c->band_end[c->bands - 1];
+  #if M800_INDEX_AXIS >= 0
+        corner[M800_INDEX_AXIS] = c->A_start + (c->keyways - 1) * c->A_step;
+  #endif
+        limits_soft_check(corner, c->plan_g0.condition);
+
+        if(sys.abort)
+            return false;
+
+        c->plan_g0.condition.target_validated = c->plan_g0.condition.target_valid = On;
+        c->plan_g1.condition.target_validated = c->plan_g1.condition.target_valid = On;
+        c->plan_air.condition.target_validated = c->plan_air.condition.target_valid = On;
+        c->plan_plunge.condition.target_validated = c->plan_plunge.condition.target_valid = On;
+    }
+#endif
+
+    // -------------------------------------------------------------------------
+    // GENERATE
+    // -------------------------------------------------------------------------
+    //  Moves are queued by m800_pump() as room frees up in the planner, from
+    //  the realtime loop. Wait here until the whole cycle has been queued so
+    //  the parser does not interleave the next block with cycle moves.
+    // -------------------------------------------------------------------------
+    c->active = true;
+
+#if M800_INSTRUMENT
+    m800_instr_reset();
+#endif
 
-    return Status_OK;
+#if M800_STATS
+    m800_stats_load();
+#endif
+
+#if M800_ADAPTIVE_FEED
+    adapt.feed = c->plan_g1.feed_rate;
+    adapt.min = adapt.feed * 0.5f;
+    adapt.max = fmaxf(fminf(adapt.feed * (float)M800_ADAPTIVE_FEED / 100.0f, settings.axis[Z_AXIS].max_rate), adapt.feed);
+    adapt.peak = -1.0f;
+#endif
+
+    do {
+        m800_pump();
+
+        while(c->active) {
+            if(m800_pump_blocked())
+                protocol_auto_cycle_start();
+            if(!protocol_execute_realtime()) {
+                c->active = false;
+                c->aborted = true;
+            }
+        }
+
+#if M800_PROBE
+        // Paused before the last level: probe, trim, generate the rest
+        if(!c->aborted && c->phase == Phase_Probe) {
+            if(m800_probe(c))
+                c->active = true;
+            else
+                c->aborted = true;
+        }
+#endif
+    } while(c->active);
+
+    if(c->aborted)
+        return false;
+
+#if M800_STATS
+    // Counted once the last move is done, at once if the marker queue is full
+    {
+        m800_marker_t end = { .type = Marker_Cycle }, *marker = m800_marker_push(Marker_Cycle);
+
+        if(marker == NULL)
+            marker = &end;
+        marker->preset = job->preset;
+        marker->tool = m800_stats_tool();
+        marker->strokes = (uint32_t)c->strokes;
+        if(marker == &end)
+            m800_stats_cycle(marker);
+    }
+#endif
+
+    M800_LOG("M800 BLOCKS: queued=%lu skipped=%lu\r\n",
+             (unsigned long)c->blocks.queued, (unsigned long)c->blocks.skipped);
+
+#if M800_TRACE
+    m800_trace_end(c, c->blocks.queued, status.total);
+#endif
+
+    // Keep the parser in step with the cycle so that the next block (or the
+    // next M800 seeded from gc_state.position) starts from the right place.
+    c->target[X_AXIS] = c->X_last;
+    c->target[Z_AXIS] = c->Z_last;
+    m800_copy_pos(gc_state.position, c->target);
+
+    return true;
 }
 
 
+#if M800_QUEUE
+
 // -----------------------------------------------------------------------------
-// EXECUTE
+// BATCH QUEUE (M805, M806)
 // -----------------------------------------------------------------------------
+//  M805 [X Y Z A] D.. Q.. S.. P.. R.. [L H J I] adds a cycle to the queue,
+//  checked with the M800 rules. The axis words give the start and are
+//  claimed, so queueing moves nothing: they are converted as a G0 target
+//  would be (G20, G90/G91, work, G92 and tool offsets) and kept in machine
+//  coordinates, so offsets may change between entries. Axes not given keep
+//  the previous entry's start, the parser position for the first one, and
+//  G91 words add to it. F is taken when the entry is queued. M805 without
+//  words empties the queue.
+//
+//  M806 runs the queue in one block: each entry is a G0 to its start
+//  followed by the cycle, queued behind the moves of the previous entry, so
+//  the planner does not run empty between cycles. The queue is emptied.
 
-static void m800_execute(uint_fast16_t state, parser_block_t *gc_block)
+// Axis words M805 takes, the index axis included
+
+static bool m800_axis_word(const parser_block_t *gc_block, uint_fast8_t axis)
 {
-    if(gc_block->user_mcode != M800_Internal) {
-        if(user_mcode_prev.execute)
-            user_mcode_prev.execute(state, gc_block);
-        return;
+    switch(axis) {
+        case X_AXIS: return gc_block->words.x;
+        case Y_AXIS: return gc_block->words.y;
+        case Z_AXIS: return gc_block->words.z;
+#if N_AXIS > 3
+        case A_AXIS: return gc_block->words.a;
+#endif
+        default: return false;
     }
+}
 
-    char dbg[128];
+// Start of the entry in machine coordinates, left in values.xyz for execute
 
-    // -------------------------------------------------------------------------
-    // GET STARTING POSITIONS (ALL AXES)
-    // -------------------------------------------------------------------------
-    float start_pos[N_AXIS];
-    float X_start = 0.0f, Z_start = 0.0f;
+static void m800_enqueue_start(parser_block_t *gc_block)
+{
+    const float *base = queue_count ? queue[queue_count - 1].start : gc_state.position;
 
-    m800_get_current_pos(start_pos);
-    X_start = start_pos[X_AXIS];
-    Z_start = start_pos[Z_AXIS];
+    for(uint_fast8_t axis = 0; axis < N_AXIS; axis++) {
 
-    // -------------------------------------------------------------------------
-    // PARAMETERS
-    // -------------------------------------------------------------------------
-    float D = gc_block->values.d;
-    float Q = -gc_block->values.q;           // Negative Z direction
-    float W =  gc_block->values.s;
-    float P =  gc_block->values.p;
-    float R =  gc_block->values.r;
-    int   Lreps = gc_block->words.l ? (int)gc_block->values.l : 1;
-    bool return_home = (gc_block->values.h == 1.0f);
+        float value = gc_block->values.xyz[axis];
 
-    protocol_buffer_synchronize();
+        if(!m800_axis_word(gc_block, axis))
+            value = base[axis];
+        else {
+            if(gc_block->modal.units_imperial && axis <= Z_AXIS)
+                value *= MM_PER_INCH;
+            if(gc_block->modal.distance_incremental)
+                value += base[axis];
+            else
+                value += gc_state.modal.coord_system.xyz[axis] + gc_state.g92_coord_offset[axis] +
+                          gc_state.tool_length_offset[axis];
+        }
 
-    // ALWAYS ON
-    hal.stream.write("M800 CYCLE START\r\n");
+        gc_block->values.xyz[axis] = value;
+    }
 
-    // DEBUG
-    M800_LOG("M800 GEOMETRY: X0=%.3f Z0=%.3f Q=%.3f W=%.3f Feed=%.3f\r\n",
-             X_start, Z_start, Q, W, gc_state.feed_rate);
+    gc_block->words.x = gc_block->words.y = gc_block->words.z = Off;
+#if N_AXIS > 3
+    gc_block->words.a = Off;
+#endif
+}
 
-    // -------------------------------------------------------------------------
-    // SAG COMPENSATION
-    // -------------------------------------------------------------------------
-    float Rbore = X_start;
-    float Cslot = W;
-    float halfC = Cslot * 0.5f;
+static status_code_t m800_enqueue_validate(parser_block_t *gc_block)
+{
+    status_code_t status;
 
-    if(halfC > Rbore) {
-        report_message("M800: Slot width exceeds bore diameter.", Message_Warning);
-        hal.stream.write("M800 CYCLE END\r\n");
-        return;
+    // Bare M805: clear, a start needs the cycle words with it
+    if(!gc_block->words.d && !gc_block->words.q && !gc_block->words.s &&
+       !gc_block->words.p && !gc_block->words.r) {
+        for(uint_fast8_t axis = 0; axis < N_AXIS; axis++) {
+            if(m800_axis_word(gc_block, axis))
+                return Status_InvalidStatement;     // a start without a cycle
+        }
+        gc_block->values.d = 0.0f;
+        return Status_OK;
     }
 
-    float d_center = sqrtf((Rbore * Rbore) - (halfC * halfC));
-    float sag = Rbore - d_center;
+    // Resume and evaluate are per call
+    if(gc_block->words.k || gc_block->words.e)
+        return Status_InvalidStatement;
 
-    float X_new_start = X_start - sag;
-    float Dcorr = D + sag;
-    float X_final = X_new_start + Dcorr;
+    if((status = m800_check_words(gc_block)) != Status_OK)
+        return status;
 
-    M800_LOG("M800 SAG: R=%.3f C=%.3f sag=%.3f X_new_start=%.3f Dcorr=%.3f Xfinal=%.3f\r\n",
-             Rbore, Cslot, sag, X_new_start, Dcorr, X_final);
+    if(gc_state.feed_rate <= 0.0f || queue_count >= M800_QUEUE)
+        return Status_InvalidStatement;
 
-    M800_LOG("M800 AXIS MASK: XZ USED | ALL OTHER AXES PRESERVED (Y, A, B, C, etc.)\r\n");
+    m800_enqueue_start(gc_block);
+    m800_claim_words(gc_block);
 
-    // -------------------------------------------------------------------------
-    // PLAN DATA INITIALIZATION
-    // -------------------------------------------------------------------------
+    return Status_OK;
+}
+
+static void m800_enqueue_execute(parser_block_t *gc_block)
+{
+#if M800_DEBUG
+    char dbg[128];
+#endif
+
+    if(gc_block->values.d <= 0.0f) {
+        queue_count = 0;
+        M800_LOG("M805 QUEUE CLEARED\r\n");
+        return;
+    }
+
+    m800_entry_t *entry = &queue[queue_count++];
+
+    m800_copy_pos(entry->start, gc_block->values.xyz);
+    m800_job_init(&entry->job, gc_block);
+
+    M800_LOG("M805 ENTRY %u: X=%.3f Z=%.3f D=%.3f Q=%.3f F=%.1f\r\n",
+             (unsigned)queue_count, entry->start[X_AXIS], entry->start[Z_AXIS],
+             entry->job.d, entry->job.q, entry->job.feed);
+}
+
+static void m800_run_execute(void)
+{
+#if M800_DEBUG
+    char dbg[128];
+#endif
+    float start_pos[N_AXIS];
     plan_line_data_t plan_g0;
-    plan_line_data_t plan_g1;
+    uint_fast8_t count = queue_count, idx;
+    bool queued = true;
 
-    plan_data_init(&plan_g0);
-    plan_data_init(&plan_g1);
+    queue_count = 0;
 
+    plan_data_init(&plan_g0);
     plan_g0.condition.rapid_motion = On;
     plan_g0.spindle = *gc_state.spindle;
 
-    plan_g1.condition.rapid_motion = Off;
-    plan_g1.feed_rate = gc_state.feed_rate;
-    plan_g1.spindle = *gc_state.spindle;
+    // One CYCLE START/END for the batch, unless each cycle reports its own
+#if !M800_ASYNC_END
+    m800_cycle_start();
+#endif
 
-    // -------------------------------------------------------------------------
-    // TRACK LAST COMMANDED POSITION (CRITICAL FOR COORDINATE COHERENCE)
-    // -------------------------------------------------------------------------
-    float last_commanded[N_AXIS];
-    m800_copy_pos(last_commanded, start_pos);
+    for(idx = 0; idx < count && queued; idx++) {
 
-    float target[N_AXIS];
+        M800_LOG("M806 ENTRY %u/%u\r\n", (unsigned)(idx + 1), (unsigned)count);
 
-    // -------------------------------------------------------------------------
-    // PRE-POSITIONING (G0 to sag-compensated X + retract Z)
-    // -------------------------------------------------------------------------
-    m800_copy_pos(target, last_commanded);
-    target[X_AXIS] = X_new_start;
-    target[Z_AXIS] = Z_start + R;
+        // Position behind the previous cycle, no planner drain
+        m800_copy_pos(start_pos, queue[idx].start);
 
-    M800_LOG("M800 G0 SAG POS: X=%.3f Z=%.3f\r\n",
-             target[X_AXIS], target[Z_AXIS]);
+        if(!mc_line(start_pos, &plan_g0))
+            return;
 
-    mc_line(target, &plan_g0);
-    m800_copy_pos(last_commanded, target);
+        m800_copy_pos(gc_state.position, start_pos);
 
-    // -------------------------------------------------------------------------
-    // FIRST PASS (ZERO PENETRATION - SAFETY PASS)
-    // -------------------------------------------------------------------------
-    for(int rep = 0; rep < Lreps; rep++) {
-
-        // G0 SAFE (already at correct position, but included for clarity)
-        m800_copy_pos(target, last_commanded);
-        target[X_AXIS] = X_new_start;
-        target[Z_AXIS] = Z_start + R;
-        M800_LOG("M800 G0 SAFE (FIRST): X=%.3f Z=%.3f (pass=0 rep=%d)\r\n",
-                 target[X_AXIS], target[Z_AXIS], rep+1);
-        mc_line(target, &plan_g0);
-        m800_copy_pos(last_commanded, target);
-
-        // G1 DEPTH (plunge in X only, Z unchanged)
-        m800_copy_pos(target, last_commanded);
-        target[X_AXIS] = X_new_start;
-        // Z remains at Z_start + R
-        M800_LOG("M800 G1 DEPTH (FIRST): X=%.3f Z=%.3f (pass=0 rep=%d)\r\n",
-                 target[X_AXIS], target[Z_AXIS], rep+1);
-        mc_line(target, &plan_g1);
-        m800_copy_pos(last_commanded, target);
-
-        // G1 LENGTH (cut in Z only, X unchanged)
-        m800_copy_pos(target, last_commanded);
-        target[Z_AXIS] = Z_start + Q;
-        M800_LOG("M800 G1 LENGTH (FIRST): X=%.3f Z=%.3f (pass=0 rep=%d)\r\n",
-                 target[X_AXIS], target[Z_AXIS], rep+1);
-        mc_line(target, &plan_g1);
-        m800_copy_pos(last_commanded, target);
-
-        // G0 BACKX (retract in X only, Z unchanged)
-        m800_copy_pos(target, last_commanded);
-        target[X_AXIS] = X_new_start;
-        M800_LOG("M800 G0 BACKX (FIRST): X=%.3f Z=%.3f (pass=0 rep=%d)\r\n",
-                 target[X_AXIS], target[Z_AXIS], rep+1);
-        mc_line(target, &plan_g0);
-        m800_copy_pos(last_commanded, target);
-
-        // G0 BACKZ (retract in Z only, X unchanged)
-        m800_copy_pos(target, last_commanded);
-        target[Z_AXIS] = Z_start + R;
-        M800_LOG("M800 G0 BACKZ (FIRST): X=%.3f Z=%.3f (pass=0 rep=%d)\r\n",
-                 target[X_AXIS], target[Z_AXIS], rep+1);
-        mc_line(target, &plan_g0);
-        m800_copy_pos(last_commanded, target);
+#if M800_ASYNC_END
+        m800_cycle_start();
+        if((queued = m800_cycle(&queue[idx].job, start_pos, 0, false)))
+            m800_cycle_end();
+#else
+        queued = m800_cycle(&queue[idx].job, start_pos, 0, false);
+#endif
     }
 
-    // -------------------------------------------------------------------------
-    // RADIAL PASSES (PROGRESSIVE DEPTH)
-    // -------------------------------------------------------------------------
-    int passes = (int)ceilf(Dcorr / P);
-
-    M800_LOG("M800 PASSES=%d L=%d\r\n", passes, Lreps);
-
-    for(int pass = 1; pass <= passes; pass++) {
-
-        float X_target = X_new_start + pass * P;
-        if(X_target > X_final)
-            X_target = X_final;
-
-        for(int rep = 0; rep < Lreps; rep++) {
-
-            // G0 SAFE (position at Z_start + R, X at X_new_start)
-            m800_copy_pos(target, last_commanded);
-            target[X_AXIS] = X_new_start;
-            target[Z_AXIS] = Z_start + R;
-            M800_LOG("M800 G0 SAFE:   X=%.3f Z=%.3f (pass=%d rep=%d)\r\n",
-                     target[X_AXIS], target[Z_AXIS], pass, rep+1);
-            mc_line(target, &plan_g0);
-            m800_copy_pos(last_commanded, target);
-
-            // G1 DEPTH (plunge to new X depth, Z unchanged)
-            m800_copy_pos(target, last_commanded);
-            target[X_AXIS] = X_target;
-            M800_LOG("M800 G1 DEPTH:  X=%.3f Z=%.3f (pass=%d rep=%d)\r\n",
-                     target[X_AXIS], target[Z_AXIS], pass, rep+1);
-            mc_line(target, &plan_g1);
-            m800_copy_pos(last_commanded, target);
-
-            // G1 LENGTH (cut full Z length, X unchanged)
-            m800_copy_pos(target, last_commanded);
-            target[Z_AXIS] = Z_start + Q;
-            M800_LOG("M800 G1 LENGTH: X=%.3f Z=%.3f (pass=%d rep=%d)\r\n",
-                     target[X_AXIS], target[Z_AXIS], pass, rep+1);
-            mc_line(target, &plan_g1);
-            m800_copy_pos(last_commanded, target);
-
-            // G0 BACKX (retract X to safe X, Z unchanged)
-            m800_copy_pos(target, last_commanded);
-            target[X_AXIS] = X_new_start;
-            M800_LOG("M800 G0 BACKX:  X=%.3f Z=%.3f (pass=%d rep=%d)\r\n",
-                     target[X_AXIS], target[Z_AXIS], pass, rep+1);
-            mc_line(target, &plan_g0);
-            m800_copy_pos(last_commanded, target);
-
-            // G0 BACKZ (retract Z to safe Z, X unchanged)
-            m800_copy_pos(target, last_commanded);
-            target[Z_AXIS] = Z_start + R;
-            M800_LOG("M800 G0 BACKZ:  X=%.3f Z=%.3f (pass=%d rep=%d)\r\n",
-                     target[X_AXIS], target[Z_AXIS], pass, rep+1);
-            mc_line(target, &plan_g0);
-            m800_copy_pos(last_commanded, target);
-        }
+#if !M800_ASYNC_END
+    if(queued)
+        m800_cycle_end();
+#endif
+}
+
+#endif
+
+
+// -----------------------------------------------------------------------------
+// CHECK
+// -----------------------------------------------------------------------------
+
+static user_mcode_type_t m800_check(user_mcode_t mcode)
+{
+    if(M800_IS_CYCLE(mcode))
+        return UserMCode_NoValueWords;
+
+#if M800_INDEX_AXIS >= 0
+    if(mcode == M800_Index)
+        return UserMCode_NoValueWords;
+#endif
+
+#if M800_Z_BANDS
+    if(mcode == M800_Bands)
+        return UserMCode_NoValueWords;
+#endif
+
+    if(mcode == M800_Accel || mcode == M800_Tool)
+        return UserMCode_NoValueWords;
+
+#if M800_PROBE
+    if(mcode == M800_Probe)
+        return UserMCode_NoValueWords;
+#endif
+
+#if M800_QUEUE
+    if(mcode == M800_Enqueue || mcode == M800_Run)
+        return UserMCode_NoValueWords;
+#endif
+
+    return user_mcode_prev.check ?
+           user_mcode_prev.check(mcode) :
+           UserMCode_Unsupported;
+}
+
+
+// -----------------------------------------------------------------------------
+// VALIDATE
+// -----------------------------------------------------------------------------
+
+static status_code_t m800_validate(parser_block_t *gc_block)
+{
+#if M800_INDEX_AXIS >= 0
+    if(gc_block->user_mcode == M800_Index)
+        return m800_index_validate(gc_block);
+#endif
+
+#if M800_Z_BANDS
+    if(gc_block->user_mcode == M800_Bands)
+        return m800_bands_validate(gc_block);
+#endif
+
+    if(gc_block->user_mcode == M800_Accel)
+        return m800_accel_validate(gc_block);
+
+    if(gc_block->user_mcode == M800_Tool)
+        return m800_tool_validate(gc_block);
+
+#if M800_PROBE
+    if(gc_block->user_mcode == M800_Probe)
+        return m800_probe_validate(gc_block);
+#endif
+
+#if M800_QUEUE
+    if(gc_block->user_mcode == M800_Enqueue)
+        return m800_enqueue_validate(gc_block);
+
+    if(gc_block->user_mcode == M800_Run)
+        return queue_count ? Status_OK : Status_InvalidStatement;
+#endif
+
+    if(!M800_IS_CYCLE(gc_block->user_mcode))
+        return user_mcode_prev.validate ?
+               user_mcode_prev.validate(gc_block) :
+               Status_Unhandled;
+
+#if M800_INSTRUMENT
+    // M800 E2: statistics query, no cycle words
+    if(gc_block->words.e && gc_block->values.e == 2.0f) {
+        gc_block->words.e = Off;
+        return Status_OK;
     }
+#endif
+
+#if M800_STATS
+    // M800 E3: production totals, E4: clear them, no cycle words
+    if(gc_block->words.e && (gc_block->values.e == 3.0f || gc_block->values.e == 4.0f)) {
+        gc_block->words.e = Off;
+        return Status_OK;
+    }
+#endif
+
+    status_code_t status;
+
+#if M800_PRESETS
+    // M81n: words not in the block come from the preset
+    if(M800_IS_PRESET(gc_block->user_mcode) && !m800_preset_merge(gc_block))
+        return Status_InvalidStatement;
+#endif
+
+    if((status = m800_check_words(gc_block)) != Status_OK)
+        return status;
+
+    if(gc_state.feed_rate <= 0.0f)
+        return Status_InvalidStatement;
+
+    m800_claim_words(gc_block);
+
+    return Status_OK;
+}
 
-    // -------------------------------------------------------------------------
-    // FINAL RETURN
-    // -------------------------------------------------------------------------
-    plan_data_init(&plan_g0);
-    plan_g0.condition.rapid_motion = On;
-    plan_g0.spindle = *gc_state.spindle;
 
-    m800_copy_pos(target, last_commanded);
-    if(return_home) {
-        target[X_AXIS] = X_start;
-        target[Z_AXIS] = Z_start;
-    } else {
-        target[X_AXIS] = X_new_start;
-        target[Z_AXIS] = Z_start + R;
+// -----------------------------------------------------------------------------
+// EXECUTE
+// -----------------------------------------------------------------------------
+
+static void m800_execute(uint_fast16_t state, parser_block_t *gc_block)
+{
+#if M800_INDEX_AXIS >= 0
+    if(gc_block->user_mcode == M800_Index) {
+        m800_index_execute(gc_block);
+        return;
     }
+#endif
 
-    M800_LOG("M800 RETURN: X=%.3f Z=%.3f\r\n",
-             target[X_AXIS], target[Z_AXIS]);
+#if M800_Z_BANDS
+    if(gc_block->user_mcode == M800_Bands) {
+        m800_bands_execute(gc_block);
+        return;
+    }
+#endif
 
-    mc_line(target, &plan_g0);
-    m800_copy_pos(last_commanded, target);
+    if(gc_block->user_mcode == M800_Accel) {
+        m800_accel_execute(gc_block);
+        return;
+    }
 
-    protocol_buffer_synchronize();
+    if(gc_block->user_mcode == M800_Tool) {
+        m800_tool_execute(gc_block);
+        return;
+    }
 
-    // ALWAYS ON
-    hal.stream.write("M800 CYCLE END\r\n");
+#if M800_PROBE
+    if(gc_block->user_mcode == M800_Probe) {
+        m800_probe_execute(gc_block);
+        return;
+    }
+#endif
+
+#if M800_QUEUE
+    if(gc_block->user_mcode == M800_Enqueue) {
+        m800_enqueue_execute(gc_block);
+        return;
+    }
+
+    if(gc_block->user_mcode == M800_Run) {
+        m800_run_execute();
+        return;
+    }
+#endif
+
+    if(!M800_IS_CYCLE(gc_block->user_mcode)) {
+        if(user_mcode_prev.execute)
+            user_mcode_prev.execute(state, gc_block);
+        return;
+    }
+
+#if M800_INSTRUMENT
+    if(gc_block->values.e == 2.0f) {
+        m800_instr_report();
+        return;
+    }
+#endif
+
+#if M800_STATS
+    if(gc_block->values.e == 3.0f) {
+        m800_stats_report();
+        m800_stats_write();     // the cycles since the last save, with the machine idle
+        return;
+    }
+
+    if(gc_block->values.e == 4.0f) {
+        m800_stats_clear();
+        return;
+    }
+#endif
+
+    m800_job_t job;
+    float start_pos[N_AXIS];
+    bool evaluate = gc_block->values.e == 1.0f;
+
+    m800_job_init(&job, gc_block);
+    m800_get_start_pos(start_pos);
+
+    // Evaluate mode only reports the estimate
+    if(!evaluate)
+        m800_cycle_start();
+
+    if(m800_cycle(&job, start_pos, (int)gc_block->values.ijk[Z_AXIS], evaluate))
+        m800_cycle_end();
 }
 
 
@@ -515,6 +4078,11 @@ static void m800_execute(uint_fast16_t state, parser_block_t *gc_block)
 // INIT
 // -----------------------------------------------------------------------------
 
+void keyway_set_load_source(keyway_load_ptr load)
+{
+    load_source = load;
+}
+
 void keyway_init(void)
 {
     memcpy(&user_mcode_prev, &grbl.user_mcode, sizeof(user_mcode_ptrs_t));
@@ -522,6 +4090,34 @@ void keyway_init(void)
     grbl.user_mcode.check    = m800_check;
     grbl.user_mcode.validate = m800_validate;
     grbl.user_mcode.execute  = m800_execute;
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = m800_execute_realtime;
+
+    on_reset = grbl.on_reset;
+    grbl.on_reset = m800_reset;
+
+#if M800_STATUS_REPORT
+    on_realtime_report = grbl.on_realtime_report;
+    grbl.on_realtime_report = m800_realtime_report;
+#endif
+
+#if M800_PRESETS
+    m800_settings_init();
+#endif
+
+#if M800_CHECKPOINT
+    checkpoint_address = nvs_alloc(sizeof(m800_progress_t));
+
+    if(!m800_checkpoint_durable()) {
+        on_report_options = grbl.on_report_options;
+        grbl.on_report_options = m800_report_options;
+    }
+#endif
+
+#if M800_STATS
+    stats_address = nvs_alloc(sizeof(m800_stats_t));
+#endif
 }
 
 #endif // M800_ENABLE
\ No newline at end of file
@@ -2,4 +2,12 @@
 
 void keyway_init(void);
 
+// Z axis load for M800_ADAPTIVE_FEED builds, eg. from Trinamic StallGuard:
+// a fraction of the stall threshold (0 = free running, 1 = stall), or < 0
+// when no sample is available. Called from the realtime loop while cutting
+// strokes execute, so it has to return without waiting.
+typedef float (*keyway_load_ptr)(void);
+
+void keyway_set_load_source(keyway_load_ptr load);
+
 
@@ -0,0 +1,5 @@
+#pragma once
+
+// keyway_sim: everything is declared in hal.h
+
+#include "hal.h"
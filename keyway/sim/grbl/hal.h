@@ -0,0 +1,371 @@
+/*
+  hal.h - host stand-in for the grblHAL core headers used by keyway.c
+
+  Only the types, fields and functions the plugin touches, with the grblHAL
+  names, so keyway.c (and old/1.0.0/keyway_plugin.c) compile unchanged for
+  keyway_sim. The other grbl/ headers of this directory include this one.
+  The functions are implemented in ../grbl_stub.c.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define N_AXIS 4
+#define X_AXIS 0
+#define Y_AXIS 1
+#define Z_AXIS 2
+#define A_AXIS 3
+
+#define On  1
+#define Off 0
+
+#define CAPS(c) ((c >= 'a' && c <= 'z') ? c & 0x5F : c)
+
+// -----------------------------------------------------------------------------
+// errors.h, report.h
+// -----------------------------------------------------------------------------
+
+typedef enum {
+    Status_OK = 0,
+    Status_BadNumberFormat = 2,
+    Status_InvalidStatement = 3,
+    Status_Unhandled = 200
+} status_code_t;
+
+typedef enum {
+    Message_Plain = 0,
+    Message_Info,
+    Message_Warning
+} message_type_t;
+
+void report_message(const char *msg, message_type_t type);
+
+// -----------------------------------------------------------------------------
+// system.h, state_machine.h, stepper.h
+// -----------------------------------------------------------------------------
+
+typedef uint16_t sys_state_t;
+
+#define STATE_IDLE       0
+#define STATE_ALARM      (1 << 0)
+#define STATE_CHECK_MODE (1 << 1)
+#define STATE_CYCLE      (1 << 3)
+#define STATE_HOLD       (1 << 4)
+
+typedef struct {
+    bool abort;
+    int32_t position[N_AXIS];           // steps
+    int32_t probe_position[N_AXIS];
+} system_t;
+
+extern system_t sys;
+
+typedef struct {
+    int dummy;
+} stepper_t;
+
+sys_state_t state_get(void);
+void system_convert_array_steps_to_mpos(float *position, int32_t *steps);
+
+// -----------------------------------------------------------------------------
+// settings.h
+// -----------------------------------------------------------------------------
+
+typedef struct {
+    float steps_per_mm;
+    float max_rate;                     // mm/min
+    float acceleration;                 // mm/min²
+    float max_travel;
+} axis_settings_t;
+
+typedef struct {
+    axis_settings_t axis[N_AXIS];
+} settings_t;
+
+extern settings_t settings;
+
+typedef enum {
+    Setting_UserDefined_0 = 450
+} setting_id_t;
+
+typedef enum {
+    Group_Root = 0,
+    Group_UserSettings = 80
+} setting_group_t;
+
+typedef enum {
+    Format_Bool = 0,
+    Format_String = 8
+} setting_datatype_t;
+
+typedef enum {
+    Setting_NonCore = 1,
+    Setting_NonCoreFn = 2
+} setting_type_t;
+
+typedef struct {
+    setting_group_t parent;
+    setting_group_t id;
+    const char *name;
+} setting_group_detail_t;
+
+typedef union {
+    uint8_t value;
+} setting_detail_flags_t;
+
+typedef struct setting_detail {
+    setting_id_t id;
+    setting_group_t group;
+    const char *name;
+    const char *unit;
+    setting_datatype_t datatype;
+    const char *format;
+    const char *min_value;
+    const char *max_value;
+    setting_type_t type;
+    void *value;
+    void *get_value;
+    bool (*is_available)(const struct setting_detail *setting, uint_fast16_t offset);
+    setting_detail_flags_t flags;
+} setting_detail_t;
+
+typedef struct {
+    setting_id_t id;
+    const char *description;
+} setting_descr_t;
+
+typedef struct setting_details {
+    const uint8_t n_groups;
+    const setting_group_detail_t *groups;
+    const uint16_t n_settings;
+    const setting_detail_t *settings;
+    const uint16_t n_descriptions;
+    const setting_descr_t *descriptions;
+    void (*save)(void);
+    void (*load)(void);
+    void (*restore)(void);
+    struct setting_details *next;
+} setting_details_t;
+
+typedef status_code_t (*setting_set_string_ptr)(setting_id_t id, char *svalue);
+typedef char *(*setting_get_string_ptr)(setting_id_t id);
+
+void settings_register(setting_details_t *details);
+
+// -----------------------------------------------------------------------------
+// nvs.h, nvs_buffer.h
+// -----------------------------------------------------------------------------
+
+typedef uint32_t nvs_address_t;
+
+enum {
+    NVS_TransferResult_Failed = 0,
+    NVS_TransferResult_Busy,
+    NVS_TransferResult_OK
+};
+
+enum {
+    NVS_None = 0,
+    NVS_EEPROM,
+    NVS_FRAM,
+    NVS_Flash,
+    NVS_Emulated
+};
+
+typedef struct {
+    uint8_t type;
+    bool (*memcpy_to_nvs)(nvs_address_t dest, uint8_t *src, uint32_t size, bool with_checksum);
+    int (*memcpy_from_nvs)(uint8_t *dest, nvs_address_t src, uint32_t size, bool with_checksum);
+} nvs_io_t;
+
+nvs_address_t nvs_alloc(size_t size);
+
+// -----------------------------------------------------------------------------
+// planner.h
+// -----------------------------------------------------------------------------
+
+typedef struct {
+    float rpm;
+} spindle_t;
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t rapid_motion     :1,
+                target_validated :1,
+                target_valid     :1,
+                inverse_time     :1;
+    };
+} planner_cond_t;
+
+typedef struct {
+    float feed_rate;
+    float rate_multiplier;
+    spindle_t spindle;
+    planner_cond_t condition;
+    int32_t line_number;
+    char *message;
+} plan_line_data_t;
+
+typedef struct plan_block {
+    float millimeters;
+    struct plan_block *next;
+} plan_block_t;
+
+void plan_data_init(plan_line_data_t *plan_data);
+bool plan_check_full_buffer(void);
+plan_block_t *plan_get_current_block(void);
+uint_fast16_t plan_get_block_buffer_available(void);
+uint_fast16_t plan_get_block_buffer_count(void);
+
+// -----------------------------------------------------------------------------
+// gcode.h
+// -----------------------------------------------------------------------------
+
+typedef uint32_t user_mcode_t;
+
+typedef enum {
+    UserMCode_Unsupported = 0,
+    UserMCode_Normal,
+    UserMCode_NoValueWords
+} user_mcode_type_t;
+
+typedef union {
+    uint32_t mask;
+    struct {
+        uint32_t a :1, b :1, c :1, d :1, e :1, f :1, h :1, i :1,
+                 j :1, k :1, l :1, n :1, o :1, p :1, q :1, r :1,
+                 s :1, t :1, u :1, v :1, w :1, x :1, y :1, z :1;
+    };
+} parameter_words_t;
+
+typedef struct {
+    float d, e, f, k, p, q, r, s;
+    float ijk[3];
+    float xyz[N_AXIS];
+    int32_t n;
+    uint32_t h;
+    uint8_t l;
+} gc_values_t;
+
+typedef struct {
+    float xyz[N_AXIS];
+} coord_data_t;
+
+typedef struct {
+    bool units_imperial;
+    bool distance_incremental;
+    coord_data_t coord_system;
+} gc_modal_t;
+
+typedef struct {
+    user_mcode_t user_mcode;
+    bool user_mcode_sync;
+    parameter_words_t words;
+    gc_values_t values;
+    gc_modal_t modal;
+} parser_block_t;
+
+typedef struct {
+    float offset[N_AXIS];
+    uint32_t tool_id;
+} tool_data_t;
+
+typedef struct {
+    gc_modal_t modal;
+    tool_data_t *tool;
+    spindle_t *spindle;
+    float feed_rate;                    // mm/min
+    float position[N_AXIS];             // machine coordinates
+    float g92_coord_offset[N_AXIS];
+    float tool_length_offset[N_AXIS];
+} parser_state_t;
+
+extern parser_state_t gc_state;
+
+typedef enum {
+    GCProbe_Found = 0,
+    GCProbe_Abort,
+    GCProbe_FailInit,
+    GCProbe_FailEnd,
+    GCProbe_CheckMode
+} gc_probe_t;
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t is_rpm_rate_adjusted :1,
+                probe_is_away        :1,
+                probe_is_no_error    :1;
+    };
+} gc_parser_flags_t;
+
+// -----------------------------------------------------------------------------
+// motion_control.h, limits.h, protocol.h
+// -----------------------------------------------------------------------------
+
+bool mc_line(float *target, plan_line_data_t *pl_data);
+gc_probe_t mc_probe_cycle(float *target, plan_line_data_t *pl_data, gc_parser_flags_t parser_flags);
+void limits_soft_check(float *target, planner_cond_t condition);
+
+bool protocol_buffer_synchronize(void);
+bool protocol_execute_realtime(void);
+void protocol_auto_cycle_start(void);
+
+// -----------------------------------------------------------------------------
+// nuts_bolts.h
+// -----------------------------------------------------------------------------
+
+#define MM_PER_INCH 25.4f
+
+bool read_float(const char *line, uint_fast8_t *char_counter, float *float_ptr);
+
+// -----------------------------------------------------------------------------
+// core.h, hal.h
+// -----------------------------------------------------------------------------
+
+typedef void (*stream_write_ptr)(const char *s);
+
+typedef union {
+    uint32_t value;
+} report_tracking_flags_t;
+
+typedef user_mcode_type_t (*user_mcode_check_ptr)(user_mcode_t mcode);
+typedef status_code_t (*user_mcode_validate_ptr)(parser_block_t *gc_block);
+typedef void (*user_mcode_execute_ptr)(uint_fast16_t state, parser_block_t *gc_block);
+
+typedef struct {
+    user_mcode_check_ptr check;
+    user_mcode_validate_ptr validate;
+    user_mcode_execute_ptr execute;
+} user_mcode_ptrs_t;
+
+typedef void (*on_execute_realtime_ptr)(uint_fast16_t state);
+typedef void (*on_realtime_report_ptr)(stream_write_ptr stream_write, report_tracking_flags_t report);
+typedef void (*on_reset_ptr)(void);
+typedef void (*on_report_options_ptr)(bool newopt);
+
+typedef struct {
+    user_mcode_ptrs_t user_mcode;
+    on_execute_realtime_ptr on_execute_realtime;
+    on_realtime_report_ptr on_realtime_report;
+    on_reset_ptr on_reset;
+    on_report_options_ptr on_report_options;
+} grbl_t;
+
+extern grbl_t grbl;
+
+typedef struct {
+    stream_write_ptr write;
+} io_stream_t;
+
+typedef struct {
+    io_stream_t stream;
+    uint32_t (*get_elapsed_ticks)(void);
+    nvs_io_t nvs;
+} hal_t;
+
+extern hal_t hal;
@@ -0,0 +1,313 @@
+/*
+  grbl_stub.c - grblHAL core stand-in for keyway_sim
+
+  Just enough of the core for the plugin to run on a host: a planner queue
+  that executes one block per realtime loop pass, the parser state, settings
+  for X and Z and a RAM NVS. Nothing here moves anything, mc_line() only adds
+  the block to sim_path.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "keyway_sim.h"
+
+settings_t settings;
+system_t sys;
+parser_state_t gc_state;
+grbl_t grbl;
+hal_t hal;
+stepper_t st;
+
+sim_path_t sim_path;
+FILE *sim_trace = NULL;
+
+static spindle_t spindle;
+static tool_data_t tool;
+static float position[N_AXIS];          // last queued target
+
+// -----------------------------------------------------------------------------
+// PLANNER
+// -----------------------------------------------------------------------------
+
+static plan_block_t blocks[SIM_PLANNER_BLOCKS];
+static uint_fast16_t block_tail = 0, block_count = 0;
+
+void plan_data_init(plan_line_data_t *plan_data)
+{
+    memset(plan_data, 0, sizeof(plan_line_data_t));
+}
+
+bool plan_check_full_buffer(void)
+{
+    return block_count == SIM_PLANNER_BLOCKS;
+}
+
+plan_block_t *plan_get_current_block(void)
+{
+    return block_count ? &blocks[block_tail] : NULL;
+}
+
+uint_fast16_t plan_get_block_buffer_available(void)
+{
+    return SIM_PLANNER_BLOCKS - block_count;
+}
+
+uint_fast16_t plan_get_block_buffer_count(void)
+{
+    return block_count;
+}
+
+// Rest to rest: accelerate, cruise, decelerate, limited by the slowest axis
+
+static float sim_block_time(const float *target, const plan_line_data_t *pl_data, float length)
+{
+    float rate = pl_data->condition.rapid_motion ? 1e9f : pl_data->feed_rate;
+    float accel = 1e9f;
+
+    for(uint_fast8_t idx = 0; idx < N_AXIS; idx++) {
+        float delta = fabsf(target[idx] - position[idx]);
+        if(delta > 0.0f) {
+            rate = fminf(rate, settings.axis[idx].max_rate * length / delta);
+            accel = fminf(accel, settings.axis[idx].acceleration * length / delta);
+        }
+    }
+
+    float ramp = rate * rate / accel;   // distance to accelerate and stop
+
+    return (length >= ramp ? length / rate + rate / accel : 2.0f * sqrtf(length / accel)) * 60.0f;
+}
+
+bool mc_line(float *target, plan_line_data_t *pl_data)
+{
+    float length = 0.0f;
+
+    // As grblHAL: wait in the realtime loop for a free block
+    while(plan_check_full_buffer()) {
+        if(!protocol_execute_realtime())
+            return false;
+    }
+
+    for(uint_fast8_t idx = 0; idx < N_AXIS; idx++)
+        length += (target[idx] - position[idx]) * (target[idx] - position[idx]);
+    length = sqrtf(length);
+
+    sim_path.blocks++;
+    sim_path.length += length;
+    if(length > 0.0f)
+        sim_path.time += sim_block_time(target, pl_data, length);
+
+    if(pl_data->condition.rapid_motion)
+        sim_path.rapids++;
+    else {
+        sim_path.X_final = fmaxf(sim_path.X_final, target[X_AXIS]);
+        sim_path.Z_cut = fminf(sim_path.Z_cut, target[Z_AXIS]);
+    }
+
+    if(sim_trace) {
+        if(pl_data->condition.rapid_motion)
+            fprintf(sim_trace, "G0 X%.4f Z%.4f\n", target[X_AXIS], target[Z_AXIS]);
+        else
+            fprintf(sim_trace, "G1 X%.4f Z%.4f F%.1f\n", target[X_AXIS], target[Z_AXIS], pl_data->feed_rate);
+    }
+
+    memcpy(position, target, sizeof(position));
+
+    blocks[(block_tail + block_count) % SIM_PLANNER_BLOCKS].millimeters = length;
+    block_count++;
+
+    return !sys.abort;
+}
+
+// -----------------------------------------------------------------------------
+// PROTOCOL
+// -----------------------------------------------------------------------------
+
+// One pass of the realtime loop: the stepper finishes one block
+
+bool protocol_execute_realtime(void)
+{
+    if(block_count) {
+        block_tail = (block_tail + 1) % SIM_PLANNER_BLOCKS;
+        block_count--;
+    }
+
+    if(grbl.on_execute_realtime)
+        grbl.on_execute_realtime(STATE_CYCLE);
+
+    return !sys.abort;
+}
+
+bool protocol_buffer_synchronize(void)
+{
+    while(block_count) {
+        if(!protocol_execute_realtime())
+            return false;
+    }
+
+    // Position of the last block, as the old plugin reads it after a sync
+    for(uint_fast8_t idx = 0; idx < N_AXIS; idx++)
+        sys.position[idx] = (int32_t)lroundf(position[idx] * settings.axis[idx].steps_per_mm);
+
+    return !sys.abort;
+}
+
+void protocol_auto_cycle_start(void)
+{
+}
+
+// -----------------------------------------------------------------------------
+// EVERYTHING ELSE THE PLUGIN CALLS
+// -----------------------------------------------------------------------------
+
+gc_probe_t mc_probe_cycle(float *target, plan_line_data_t *pl_data, gc_parser_flags_t parser_flags)
+{
+    return GCProbe_FailEnd;
+}
+
+void limits_soft_check(float *target, planner_cond_t condition)
+{
+}
+
+sys_state_t state_get(void)
+{
+    return block_count ? STATE_CYCLE : STATE_IDLE;
+}
+
+void system_convert_array_steps_to_mpos(float *position, int32_t *steps)
+{
+    for(uint_fast8_t idx = 0; idx < N_AXIS; idx++)
+        position[idx] = (float)steps[idx] / settings.axis[idx].steps_per_mm;
+}
+
+void report_message(const char *msg, message_type_t type)
+{
+    fprintf(stderr, "%s\n", msg);
+}
+
+bool read_float(const char *line, uint_fast8_t *char_counter, float *float_ptr)
+{
+    char *end;
+
+    *float_ptr = strtof(line + *char_counter, &end);
+
+    if(end == line + *char_counter)
+        return false;
+
+    *char_counter = (uint_fast8_t)(end - line);
+
+    return true;
+}
+
+void settings_register(setting_details_t *details)
+{
+}
+
+// -----------------------------------------------------------------------------
+// NVS (RAM)
+// -----------------------------------------------------------------------------
+
+static uint8_t nvs[2048];
+static nvs_address_t nvs_next = 0;
+
+nvs_address_t nvs_alloc(size_t size)
+{
+    if(nvs_next + size > sizeof(nvs))
+        return 0;
+
+    nvs_next += (nvs_address_t)size;
+
+    return nvs_next - (nvs_address_t)size + 1;  // 0 = failed
+}
+
+static bool nvs_write(nvs_address_t dest, uint8_t *src, uint32_t size, bool with_checksum)
+{
+    memcpy(&nvs[dest - 1], src, size);
+
+    return true;
+}
+
+static int nvs_read(uint8_t *dest, nvs_address_t src, uint32_t size, bool with_checksum)
+{
+    memcpy(dest, &nvs[src - 1], size);
+
+    return NVS_TransferResult_OK;
+}
+
+// -----------------------------------------------------------------------------
+// MACHINE
+// -----------------------------------------------------------------------------
+
+static void stream_write(const char *s)
+{
+    if(getenv("KEYWAY_SIM_VERBOSE"))
+        fputs(s, stdout);
+}
+
+static uint32_t elapsed_ticks(void)
+{
+    return (uint32_t)(clock() / (CLOCKS_PER_SEC / 1000));
+}
+
+// The core always has a handler in these, plugins call the previous one
+
+static void execute_realtime(uint_fast16_t state)
+{
+}
+
+static void realtime_report(stream_write_ptr stream_write, report_tracking_flags_t report)
+{
+}
+
+static void report_options(bool newopt)
+{
+}
+
+// 100 steps/mm, 3000 mm/min and 100 mm/s² on every axis
+
+void sim_init(void)
+{
+    for(uint_fast8_t idx = 0; idx < N_AXIS; idx++) {
+        settings.axis[idx].steps_per_mm = 100.0f;
+        settings.axis[idx].max_rate = 3000.0f;
+        settings.axis[idx].acceleration = 100.0f * 60.0f * 60.0f;
+        settings.axis[idx].max_travel = -200.0f;
+    }
+
+    hal.stream.write = stream_write;
+    hal.get_elapsed_ticks = elapsed_ticks;
+    hal.nvs.type = NVS_EEPROM;
+    hal.nvs.memcpy_to_nvs = nvs_write;
+    hal.nvs.memcpy_from_nvs = nvs_read;
+
+    grbl.on_execute_realtime = execute_realtime;
+    grbl.on_realtime_report = realtime_report;
+    grbl.on_report_options = report_options;
+
+    gc_state.spindle = &spindle;
+    gc_state.tool = &tool;
+
+    // The planner blocks form a ring, as in grblHAL
+    for(uint_fast16_t idx = 0; idx < SIM_PLANNER_BLOCKS; idx++)
+        blocks[idx].next = &blocks[(idx + 1) % SIM_PLANNER_BLOCKS];
+}
+
+void sim_reset(const float start[N_AXIS])
+{
+    while(block_count)
+        protocol_execute_realtime();
+
+    sys.abort = false;
+
+    memcpy(position, start, sizeof(position));
+    memcpy(gc_state.position, start, sizeof(gc_state.position));
+
+    for(uint_fast8_t idx = 0; idx < N_AXIS; idx++)
+        sys.position[idx] = (int32_t)lroundf(start[idx] * settings.axis[idx].steps_per_mm);
+
+    memset(&sim_path, 0, sizeof(sim_path_t));
+    sim_path.X_final = -1e9f;
+    sim_path.Z_cut = 1e9f;
+}
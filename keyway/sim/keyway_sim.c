@@ -0,0 +1,432 @@
+/*
+  keyway_sim.c - host simulation and benchmark of the M800 keyway cycle
+
+  Runs the plugin against the grblHAL stand-in of grbl_stub.c, no hardware
+  needed. The cycles are called through the user M-code hooks exactly as the
+  parser calls them (check, validate, execute).
+
+      keyway_sim        every cycle of the parameter matrix (D Q S P L H):
+                        planner blocks, path length and time (each block
+                        from rest to rest, an upper bound), then the move
+                        generation throughput
+      keyway_sim trace [file]
+                        move trace of the fixed trace cycles, one line per
+                        mc_line() (stdout without file)
+      keyway_sim check <golden>
+                        records the trace again and compares it with a
+                        golden trace line by line
+      keyway_sim diff <a> <b>
+                        blocks and time of every cycle of trace b against
+                        trace a, X_final and the cut Z must be the same
+
+  The same source builds keyway_sim_1.0.0 against old/1.0.0/keyway_plugin.c,
+  KEYWAY_SIM_VERSION names the build in the trace header.
+
+  Exit status 1 if a cycle is rejected or queues no moves, the trace differs
+  from the golden one or diff finds a changed geometry.
+*/
+
+#define _POSIX_C_SOURCE 199309L // clock_gettime() with -std=c11
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "keyway.h"
+#include "keyway_sim.h"
+
+#ifndef KEYWAY_SIM_VERSION
+#define KEYWAY_SIM_VERSION "current"
+#endif
+
+#define SIM_GEOMETRY_TOL 0.001f // mm, diff: X_final and cut Z
+
+typedef struct {
+    float d, q, s, p, r;
+    uint8_t l;
+    uint32_t h;
+} sim_cycle_t;
+
+#define SIM_START_X 10.0f       // bore radius, the cycle starts at the wall
+#define SIM_START_Z 10.0f
+#define SIM_FEED    200.0f
+
+static void sim_cycle_name(const sim_cycle_t *cycle, char *name, size_t size)
+{
+    snprintf(name, size, "D%g Q%g S%g P%g R%g L%u H%u",
+             cycle->d, cycle->q, cycle->s, cycle->p, cycle->r, (unsigned)cycle->l, (unsigned)cycle->h);
+}
+
+// One M800 block, from the start position, through the M-code hooks
+
+static status_code_t sim_run(const sim_cycle_t *cycle)
+{
+    float start[N_AXIS] = {0};
+    parser_block_t block = {0};
+    status_code_t status;
+
+    start[X_AXIS] = SIM_START_X;
+    start[Z_AXIS] = SIM_START_Z;
+    sim_reset(start);
+
+    gc_state.feed_rate = SIM_FEED;
+
+    block.user_mcode = 800;
+    block.words.d = block.words.q = block.words.s = block.words.p = block.words.r = On;
+    block.words.l = block.words.h = On;
+    block.values.d = cycle->d;
+    block.values.q = cycle->q;
+    block.values.s = cycle->s;
+    block.values.p = cycle->p;
+    block.values.r = cycle->r;
+    block.values.l = cycle->l;
+    block.values.h = cycle->h;
+
+    if(grbl.user_mcode.check(block.user_mcode) == UserMCode_Unsupported)
+        return Status_Unhandled;
+
+    if((status = grbl.user_mcode.validate(&block)) == Status_OK) {
+        grbl.user_mcode.execute(STATE_IDLE, &block);
+        protocol_buffer_synchronize();
+    }
+
+    return status;
+}
+
+// -----------------------------------------------------------------------------
+// PARAMETER MATRIX
+// -----------------------------------------------------------------------------
+
+static int sim_matrix(void)
+{
+    static const float D[] = { 0.5f, 2.0f }, Q[] = { 5.0f, 25.0f }, S[] = { 3.0f, 8.0f }, P[] = { 0.1f, 0.4f };
+    static const uint8_t L[] = { 1, 2 };
+    static const uint32_t H[] = { 0, 1 };
+    sim_cycle_t cycle = { .r = 2.0f };
+    int failed = 0;
+
+    printf("%-30s %8s %8s %8s %10s %9s\n", "cycle", "blocks", "rapids", "length", "time", "X_final");
+
+    for(uint_fast8_t d = 0; d < 2; d++)
+    for(uint_fast8_t q = 0; q < 2; q++)
+    for(uint_fast8_t s = 0; s < 2; s++)
+    for(uint_fast8_t p = 0; p < 2; p++)
+    for(uint_fast8_t l = 0; l < 2; l++)
+    for(uint_fast8_t h = 0; h < 2; h++) {
+
+        char name[64];
+        status_code_t status;
+
+        cycle.d = D[d];
+        cycle.q = Q[q];
+        cycle.s = S[s];
+        cycle.p = P[p];
+        cycle.l = L[l];
+        cycle.h = H[h];
+
+        sim_cycle_name(&cycle, name, sizeof(name));
+
+        if((status = sim_run(&cycle)) != Status_OK || sim_path.blocks == 0) {
+            printf("%-30s FAILED (status %d)\n", name, (int)status);
+            failed++;
+            continue;
+        }
+
+        printf("%-30s %8lu %8lu %7.1fmm %9.2fs %9.4f\n", name,
+               (unsigned long)sim_path.blocks, (unsigned long)sim_path.rapids,
+               sim_path.length, sim_path.time, sim_path.X_final);
+    }
+
+    return failed;
+}
+
+// -----------------------------------------------------------------------------
+// GENERATOR THROUGHPUT
+// -----------------------------------------------------------------------------
+//  A long cycle run repeatedly for at least half a second. The time includes
+//  the stand-in planner, which only counts, so it is the plugin's time per
+//  planner block: compare builds on the same host, not hosts.
+
+static void sim_benchmark(void)
+{
+    static const sim_cycle_t cycle = { .d = 6.0f, .q = 20.0f, .s = 8.0f, .p = 0.01f, .r = 2.0f, .l = 2, .h = 1 };
+    struct timespec t0, t1;
+    uint32_t runs = 0;
+    uint64_t blocks = 0;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    do {
+        if(sim_run(&cycle) != Status_OK)
+            return;
+        blocks += sim_path.blocks;
+        runs++;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        elapsed = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    } while(elapsed < 0.5);
+
+    printf("\ngenerator: D6 Q20 S8 P0.01 R2 L2 H1, %lu blocks x %lu runs, %.0f ns/block, %.2f Mblocks/s\n",
+           (unsigned long)(blocks / runs), (unsigned long)runs,
+           elapsed * 1e9 / (double)blocks, (double)blocks / elapsed * 1e-6);
+}
+
+// -----------------------------------------------------------------------------
+// MOVE TRACE
+// -----------------------------------------------------------------------------
+//  Cycles both versions accept, so their traces can be compared. Every cycle
+//  is recorded as
+//
+//      CYCLE D.. Q.. S.. P.. R.. L.. H..
+//      G0 X.. Z..                  one line per mc_line()
+//      G1 X.. Z.. F..
+//      END blocks=.. length=.. time=.. X_final=.. Z_cut=..
+//
+//  after a "# keyway_sim trace, keyway <version>" header line.
+
+static const sim_cycle_t trace_cycles[] = {
+    { .d = 2.0f, .q = 10.0f, .s = 8.0f, .p = 0.5f,  .r = 2.0f, .l = 1, .h = 1 },   // README example
+    { .d = 0.5f, .q = 5.0f,  .s = 3.0f, .p = 0.1f,  .r = 2.0f, .l = 1, .h = 0 },
+    { .d = 1.0f, .q = 8.0f,  .s = 4.0f, .p = 0.3f,  .r = 1.0f, .l = 2, .h = 0 },   // P does not divide D
+    { .d = 3.0f, .q = 20.0f, .s = 6.0f, .p = 0.25f, .r = 2.0f, .l = 1, .h = 1 },
+    { .d = 2.0f, .q = 25.0f, .s = 8.0f, .p = 0.4f,  .r = 2.0f, .l = 2, .h = 1 }
+};
+
+static int sim_trace_write(FILE *file)
+{
+    int failed = 0;
+
+    fprintf(file, "# keyway_sim trace, keyway %s\n", KEYWAY_SIM_VERSION);
+
+    for(uint_fast8_t idx = 0; idx < sizeof(trace_cycles) / sizeof(sim_cycle_t); idx++) {
+
+        char name[64];
+        status_code_t status;
+
+        sim_cycle_name(&trace_cycles[idx], name, sizeof(name));
+        fprintf(file, "CYCLE %s\n", name);
+
+        sim_trace = file;
+        status = sim_run(&trace_cycles[idx]);
+        sim_trace = NULL;
+
+        if(status != Status_OK || sim_path.blocks == 0) {
+            fprintf(stderr, "%s: FAILED (status %d)\n", name, (int)status);
+            failed++;
+        }
+
+        fprintf(file, "END blocks=%lu length=%.4f time=%.3f X_final=%.4f Z_cut=%.4f\n",
+                (unsigned long)sim_path.blocks, sim_path.length, sim_path.time, sim_path.X_final, sim_path.Z_cut);
+    }
+
+    return failed;
+}
+
+// First line that differs, both traces read from the start
+
+static int sim_trace_compare(FILE *golden, FILE *trace, const char *golden_name)
+{
+    char expected[128], actual[128];
+    uint32_t line = 0;
+
+    for(;;) {
+        bool more_golden = !!fgets(expected, sizeof(expected), golden),
+             more_trace = !!fgets(actual, sizeof(actual), trace);
+
+        line++;
+
+        if(!more_golden && !more_trace)
+            return 0;
+
+        if(more_golden != more_trace || strcmp(expected, actual)) {
+            printf("%s:%lu: trace differs\n", golden_name, (unsigned long)line);
+            printf("  golden: %s", more_golden ? expected : "(end of file)\n");
+            printf("  now:    %s", more_trace ? actual : "(end of file)\n");
+            printf("regenerate it with: keyway_sim%s trace %s\n",
+                   strcmp(KEYWAY_SIM_VERSION, "current") ? "_" KEYWAY_SIM_VERSION : "", golden_name);
+            return 1;
+        }
+    }
+}
+
+static int sim_check(const char *golden_name)
+{
+    FILE *golden, *trace;
+    int failed;
+
+    if((golden = fopen(golden_name, "r")) == NULL) {
+        perror(golden_name);
+        return 1;
+    }
+
+    if((trace = tmpfile()) == NULL) {
+        perror("tmpfile");
+        fclose(golden);
+        return 1;
+    }
+
+    failed = sim_trace_write(trace);
+    rewind(trace);
+    failed += sim_trace_compare(golden, trace, golden_name);
+
+    fclose(trace);
+    fclose(golden);
+
+    if(!failed)
+        printf("%s: trace unchanged\n", golden_name);
+
+    return failed ? 1 : 0;
+}
+
+// -----------------------------------------------------------------------------
+// TRACE DIFF
+// -----------------------------------------------------------------------------
+
+#define SIM_DIFF_CYCLES 32
+
+typedef struct {
+    char name[64];
+    sim_path_t path;
+    bool ended;
+} sim_trace_cycle_t;
+
+// The CYCLE and END lines of a trace, the moves are not needed
+
+static int sim_trace_read(const char *file_name, sim_trace_cycle_t *cycles)
+{
+    FILE *file;
+    char line[128];
+    int count = 0;
+
+    if((file = fopen(file_name, "r")) == NULL) {
+        perror(file_name);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), file)) {
+
+        if(!strncmp(line, "CYCLE ", 6)) {
+            if(count == SIM_DIFF_CYCLES)
+                break;
+            memset(&cycles[count], 0, sizeof(sim_trace_cycle_t));
+            strncpy(cycles[count].name, line + 6, sizeof(cycles[count].name) - 1);
+            cycles[count].name[strcspn(cycles[count].name, "\r\n")] = '\0';
+            count++;
+        } else if(!strncmp(line, "END ", 4) && count) {
+            unsigned long blocks;
+            sim_path_t *path = &cycles[count - 1].path;
+            if(sscanf(line, "END blocks=%lu length=%f time=%f X_final=%f Z_cut=%f",
+                       &blocks, &path->length, &path->time, &path->X_final, &path->Z_cut) == 5) {
+                path->blocks = (uint32_t)blocks;
+                cycles[count - 1].ended = true;
+            }
+        }
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+static int sim_diff(const char *a_name, const char *b_name)
+{
+    static sim_trace_cycle_t a[SIM_DIFF_CYCLES], b[SIM_DIFF_CYCLES];
+    int a_count, b_count, failed = 0;
+    long blocks_a = 0, blocks_b = 0;
+    double time_a = 0.0, time_b = 0.0;
+
+    if((a_count = sim_trace_read(a_name, a)) < 0 || (b_count = sim_trace_read(b_name, b)) < 0)
+        return 1;
+
+    if(a_count != b_count) {
+        printf("%s has %d cycles, %s %d\n", a_name, a_count, b_name, b_count);
+        return 1;
+    }
+
+    printf("a: %s\nb: %s\n\n", a_name, b_name);
+    printf("%-30s %8s %8s %7s %9s %9s %8s  %s\n", "cycle", "blocks a", "b", "delta", "time a", "b", "delta", "geometry");
+
+    for(int idx = 0; idx < a_count; idx++) {
+
+        const sim_path_t *pa = &a[idx].path, *pb = &b[idx].path;
+
+        if(strcmp(a[idx].name, b[idx].name) || !a[idx].ended || !b[idx].ended) {
+            printf("%-30s cycle %d differs or has no END line (b: %s)\n", a[idx].name, idx + 1, b[idx].name);
+            failed++;
+            continue;
+        }
+
+        bool same = fabsf(pa->X_final - pb->X_final) <= SIM_GEOMETRY_TOL &&
+                     fabsf(pa->Z_cut - pb->Z_cut) <= SIM_GEOMETRY_TOL;
+
+        printf("%-30s %8lu %8lu %+7ld %8.2fs %8.2fs %+7.2fs  ", a[idx].name,
+               (unsigned long)pa->blocks, (unsigned long)pb->blocks, (long)pb->blocks - (long)pa->blocks,
+               pa->time, pb->time, pb->time - pa->time);
+
+        if(same)
+            printf("same\n");
+        else {
+            printf("CHANGED X_final %.4f -> %.4f Z_cut %.4f -> %.4f\n", pa->X_final, pb->X_final, pa->Z_cut, pb->Z_cut);
+            failed++;
+        }
+
+        blocks_a += pa->blocks;
+        blocks_b += pb->blocks;
+        time_a += pa->time;
+        time_b += pb->time;
+    }
+
+    printf("%-30s %8ld %8ld %+7ld %8.2fs %8.2fs %+7.2fs\n", "total",
+           blocks_a, blocks_b, blocks_b - blocks_a, time_a, time_b, time_b - time_a);
+
+    return failed ? 1 : 0;
+}
+
+static int sim_usage(void)
+{
+    fprintf(stderr, "usage: keyway_sim [trace [file] | check <golden> | diff <a> <b>]\n");
+
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    int failed;
+
+    if(argc > 1 && !strcmp(argv[1], "diff"))
+        return argc == 4 ? sim_diff(argv[2], argv[3]) : sim_usage();
+
+    sim_init();
+    keyway_init();
+
+    if(argc > 1 && !strcmp(argv[1], "trace")) {
+
+        FILE *file = stdout;
+
+        if(argc > 3)
+            return sim_usage();
+
+        if(argc == 3 && (file = fopen(argv[2], "w")) == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+
+        failed = sim_trace_write(file);
+
+        if(file != stdout)
+            fclose(file);
+
+    } else if(argc > 1 && !strcmp(argv[1], "check"))
+        return argc == 3 ? sim_check(argv[2]) : sim_usage();
+
+    else if(argc > 1)
+        return sim_usage();
+
+    else {
+        failed = sim_matrix();
+        sim_benchmark();
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+/*
+  keyway_sim.h - simulated machine of the keyway_sim host build
+
+  grbl_stub.c stands in for the grblHAL core: mc_line() queues into a planner
+  of SIM_PLANNER_BLOCKS blocks and every protocol_execute_realtime() call
+  executes one block, so the plugin sees the same back pressure as on the
+  controller. Every mc_line() is added to sim_path and, while sim_trace is
+  set, written to it as one trace line:
+
+      G0 X<target> Z<target>
+      G1 X<target> Z<target> F<feed rate>
+*/
+
+#pragma once
+
+#include <stdio.h>
+
+#include "grbl/hal.h"
+
+#define SIM_PLANNER_BLOCKS 35   // grblHAL default block buffer
+
+typedef struct {
+    uint32_t blocks;            // mc_line() calls
+    uint32_t rapids;            // of them G0
+    float length;               // mm, all axes
+    float time;                 // s, every block from rest to rest (upper bound)
+    float X_final;              // deepest feed move
+    float Z_cut;                // lowest feed move
+} sim_path_t;
+
+extern sim_path_t sim_path;
+extern FILE *sim_trace;                 // NULL = no trace
+
+// Machine settings and HAL, before keyway_init()
+void sim_init(void);
+
+// Start a cycle: machine at start (machine coordinates), planner empty,
+// sim_path cleared
+void sim_reset(const float start[N_AXIS]);